@@ -1,61 +1,311 @@
+#ifdef __linux__
+#define _GNU_SOURCE
+#define KMEANS_THREADS
+#endif
+
 #include <stdio.h>   
 #include <stdlib.h>  
+#include <string.h>
 #include <math.h>
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#ifdef __linux__
+#include <unistd.h>
+#endif
+#ifdef KMEANS_THREADS
+#include <pthread.h>
+#include <sched.h>
+#endif
 
 #define MIN_K 1
 #define MIN_ITER 1
 #define MAX_ITER 1000
 #define DEFAULT_ITER 400
 #define INITIAL_CAPACITY 10 
-#define MAX_LINE_LENGTH 1024 
+#define READ_CHUNK_SIZE 65536
+#define PARSE_CHUNK_SIZE (1 << 20)
+#define STREAM_BATCH_SIZE (MAX_THREADS * PARSE_CHUNK_SIZE)
 #define MAX_COORD_LENGTH 100 
 #define EPSILON 0.001
+#define HUGEPAGE_SIZE (2 * 1024 * 1024)
+#define CORESET_SEED 1234
+#define MAX_FIXED_DIMENSION 16
+#define DEFAULT_CHECKPOINT_EVERY 10
+#define CHECKPOINT_MAGIC "KMCKPT1"
+#define QUANTIZE_NONE 0
+#define QUANTIZE_F16 1
+#define QUANTIZE_INT8 2
+#define MAX_THREADS 64
+#define MAX_NUMA_NODES 64
+#define MIN_ROWS_PER_THREAD 4096
+
+typedef struct kmeans_options {
+    int coreset_size;
+    const char *checkpoint_path;
+    int checkpoint_every;
+    const char *resume_path;
+    int bisecting;
+    int refine;
+    int quantize;
+    int threads;
+    int numa;
+    int hugepages;
+} kmeans_options;
+
+/*
+ * The loaded vectors in their storage format: a contiguous block of double
+ * rows, float16 codes, or int8 codes that decode to offset[d] + scale[d] *
+ * code.
+ */
+typedef struct dataset {
+    int format;
+    int num_vectors;
+    int dimension;
+    double *values;
+    unsigned short *halves;
+    signed char *codes;
+    double *scale;
+    double *offset;
+} dataset;
+
+typedef void (*parallel_task_fn)(void *arg, int thread_index, int num_threads);
+typedef struct thread_pool thread_pool;
+
+#ifdef KMEANS_THREADS
+typedef struct thread_worker {
+    thread_pool *pool;
+    int index;
+} thread_worker;
+
+struct thread_pool {
+    int num_threads;
+    int pin_threads;
+    int *cpus;
+    int num_cpus;
+    pthread_t *threads;
+    thread_worker *workers;
+    pthread_mutex_t lock;
+    pthread_cond_t work_ready;
+    pthread_cond_t work_done;
+    parallel_task_fn task;
+    void *arg;
+    int active_threads;
+    int pending;
+    unsigned long generation;
+    int shutdown;
+};
+#endif
+
+typedef int (*nearest_centroid_fn)(const dataset *data, size_t row, double **centroids, int k);
+typedef void (*accumulate_point_fn)(double *sum, const dataset *data, size_t row, double weight);
+
+typedef struct parse_task {
+    char *buffer;
+    size_t *chunk_starts;
+    size_t num_chunks;
+    size_t *chunk_rows;
+    size_t *chunk_first_row;
+    int *chunk_failed;
+    size_t first_row;
+    size_t num_rows;
+    int dimension;
+    double *data;
+    dataset *target;
+    int scan_range;
+    double *scratch;
+    double *range_min;
+    double *range_max;
+    double *chunk_squared_error;
+    double *chunk_max_error;
+} parse_task;
 
-int validate_input(int argc, char *argv[], int *k, int *iterations);
-double **load_input(int *num_vectors_ptr, int *dimension_ptr);
-void kmeans(double **vectors, int num_vectors, int dimension, int k, int iterations);
-void free_vectors_array(double **vectors, int num_vectors);
+typedef struct assignment_task {
+    const dataset *data;
+    double *weights;
+    double **centroids;
+    double *block_sums;
+    double *block_weights;
+    size_t num_blocks;
+    int k;
+    int dimension;
+    int replicate;
+    nearest_centroid_fn nearest;
+    accumulate_point_fn accumulate;
+} assignment_task;
+
+/*
+ * Shared by the coreset passes and the inertia check: every pass fills one
+ * slot of block_sums or block_totals per row block, and scratch holds a
+ * decoded row per thread.
+ */
+typedef struct coreset_task {
+    const dataset *data;
+    double **centroids;
+    int k;
+    double *mean;
+    double *probabilities;
+    double *block_sums;
+    double *block_totals;
+    double *scratch;
+    double total;
+    size_t num_blocks;
+    int dimension;
+    nearest_centroid_fn nearest;
+    accumulate_point_fn accumulate;
+} coreset_task;
+
+int validate_input(int argc, char *argv[], int *k, int *iterations, kmeans_options *options);
+int parse_options(int argc, char *argv[], char **positional, int *num_positional, kmeans_options *options);
+int default_thread_count(void);
+int parse_positive_int(const char *s, int *value);
+char *read_all_input(size_t *length_ptr);
+int detect_dimension(char *text);
+int parse_vector_line(const char *line, double *vec, int dim);
+size_t split_chunks(const char *buffer, size_t length, size_t **starts_ptr);
+void count_chunk_rows(void *arg, int thread_index, int num_threads);
+void parse_chunks(void *arg, int thread_index, int num_threads);
+dataset *load_input(const kmeans_options *options, thread_pool *pool);
+dataset *load_streamed_input(const kmeans_options *options, thread_pool *pool);
+int run_clustering(int k, int iterations, const kmeans_options *options, thread_pool *pool);
+double **cluster_points(const dataset *data, double *weights, int k, int iterations, const kmeans_options *options, double **initial_centroids, thread_pool *pool);
+double **kmeans(const dataset *data, double *weights, int k, int iterations, const kmeans_options *options, double **initial_centroids, thread_pool *pool);
+double **bisecting_kmeans(const dataset *data, double *weights, int k, int iterations);
+int split_cluster(const dataset *data, double *weights, int *members, int size, int iterations);
+void cluster_mean(const dataset *data, double *weights, const int *members, int size, double *mean);
+double cluster_sse(const dataset *data, double *weights, const int *members, int size, const double *centroid, double *buffer);
+unsigned long fingerprint_input(const dataset *data, double *weights);
+unsigned long hash_bytes(unsigned long hash, const void *data, size_t length);
+int write_checkpoint(const char *path, double **centroids, int k, int dimension, int num_vectors, int next_iteration, unsigned long fingerprint);
+int read_checkpoint(const char *path, double **centroids, int k, int dimension, int num_vectors, unsigned long fingerprint, int *next_iteration_ptr);
+double *build_coreset(const dataset *data, int sample_size, double **weights_ptr, int *coreset_size_ptr, thread_pool *pool);
+void coreset_sum_shard(void *arg, int thread_index, int num_threads);
+void coreset_distance_shard(void *arg, int thread_index, int num_threads);
+void coreset_cumulative_shard(void *arg, int thread_index, int num_threads);
+void coreset_offset_shard(void *arg, int thread_index, int num_threads);
+double random_uniform(void);
+int compute_inertia(const dataset *data, double **centroids, int k, double *inertia_ptr, thread_pool *pool);
+void inertia_shard(void *arg, int thread_index, int num_threads);
+void free_centroids(double **centroids, int k);
+void wrap_vectors(dataset *data, double *values, int num_vectors, int dimension);
+const double *dataset_row(const dataset *data, size_t row, double *buffer);
+void encode_row(dataset *data, size_t row, const double *values, double *squared_error, double *max_error);
+void free_dataset(dataset *data);
+unsigned short double_to_half(double value);
+float half_to_float(unsigned short half);
+void select_kernels(const dataset *data, nearest_centroid_fn *nearest_ptr, accumulate_point_fn *accumulate_ptr);
+void *allocate_vector_data(size_t bytes, int hugepages);
+thread_pool *create_thread_pool(int num_threads, int pin_threads);
+void destroy_thread_pool(thread_pool *pool);
+void run_parallel(thread_pool *pool, parallel_task_fn task, void *arg, int max_threads);
+void shard_range(size_t num_items, int thread_index, int num_threads, size_t *start_ptr, size_t *end_ptr);
+size_t num_row_blocks(size_t num_rows);
+void shard_rows(size_t num_rows, int thread_index, int num_threads, size_t *start_ptr, size_t *end_ptr);
+void assign_shard(void *arg, int thread_index, int num_threads);
+#ifdef KMEANS_THREADS
+int allowed_cpus(int *cpus, int max_cpus);
+int read_node_cpus(int node, cpu_set_t *cpus);
+void pin_thread(thread_pool *pool, int index);
+void *thread_pool_worker(void *arg);
+#endif
 void print_result(double **centroids, int k, int dimension);
 int is_number(double val);
+double squared_distance(const double *point1, const double *point2, int dimension);
 double euclidean_distance(double *point1, double *point2, int dimension);
 
 int main(int argc, char **argv) {
     int k, iterations;
-    int num_vectors = 0;
-    int dimension = 0;
-    double **vectors;
+    int status;
+    thread_pool *pool;
+    kmeans_options options;
 
-    if (!validate_input(argc, argv, &k, &iterations)) {
+    if (!validate_input(argc, argv, &k, &iterations, &options)) {
         return 1;
     }
 
-    vectors = load_input(&num_vectors, &dimension);
-    if (!vectors) {
+    pool = create_thread_pool(options.threads, options.numa);
+    status = run_clustering(k, iterations, &options, pool);
+    destroy_thread_pool(pool);
+    return status;
+}
+
+int run_clustering(int k, int iterations, const kmeans_options *options, thread_pool *pool) {
+    int coreset_size = 0;
+    double inertia = 0.0;
+    dataset *data;
+    dataset coreset_data;
+    double *coreset = NULL;
+    double *weights = NULL;
+    double **centroids;
+
+    data = load_input(options, pool);
+    if (!data) {
         return 1; 
     }
 
-    if (k >= num_vectors) {
+    if (k >= data->num_vectors) {
         printf("Incorrect number of clusters!\n");
-        free_vectors_array(vectors, num_vectors);
+        free_dataset(data);
+        return 1;
+    }
+
+    /* a coreset at least as large as the input would not be smaller, so the full data is used */
+    if (options->coreset_size > 0 && options->coreset_size < data->num_vectors) {
+        coreset = build_coreset(data, options->coreset_size, &weights, &coreset_size, pool);
+        if (!coreset) {
+            free_dataset(data);
+            return 1;
+        }
+        /* k is valid for the input; the sample just drew too few distinct rows */
+        if (k >= coreset_size) {
+            printf("An Error Has Occurred\n");
+            free(coreset);
+            free(weights);
+            free_dataset(data);
+            return 1;
+        }
+        wrap_vectors(&coreset_data, coreset, coreset_size, data->dimension);
+        centroids = cluster_points(&coreset_data, weights, k, iterations, options, NULL, pool);
+        free(coreset);
+        free(weights);
+    } else {
+        centroids = cluster_points(data, NULL, k, iterations, options, NULL, pool);
+    }
+
+    if (!centroids) {
+        free_dataset(data);
         return 1;
     }
 
-    kmeans(vectors, num_vectors, dimension, k, iterations);
-    free_vectors_array(vectors, num_vectors);
+    print_result(centroids, k, data->dimension);
+    if (options->coreset_size > 0) {
+        if (compute_inertia(data, centroids, k, &inertia, pool) < 0) {
+            printf("An Error Has Occurred\n");
+            free_centroids(centroids, k);
+            free_dataset(data);
+            return 1;
+        }
+        fprintf(stderr, "Inertia: %.4f\n", inertia);
+    }
+    free_centroids(centroids, k);
+    free_dataset(data);
     return 0;
 }
 
-int validate_input(int argc, char *argv[], int *k, int *iterations) {
+int validate_input(int argc, char *argv[], int *k, int *iterations, kmeans_options *options) {
     char *endptr;
     double k_double;
     double iter_double;
+    char *positional[2];
+    int num_positional = 0;
 
-    if (argc < 2 || argc > 3) {
+    if (!parse_options(argc, argv, positional, &num_positional, options) || num_positional < 1) {
         printf("An Error Has Occurred\n");
         return 0;
     }
 
-    k_double = strtod(argv[1], &endptr);
+    k_double = strtod(positional[0], &endptr);
     if (*endptr != '\0') {
         printf("Incorrect number of clusters!\n");  
         return 0;
@@ -76,8 +326,8 @@ int validate_input(int argc, char *argv[], int *k, int *iterations) {
     }
     *k = (int)k_double;
 
-    if (argc == 3) {
-        iter_double = strtod(argv[2], &endptr);
+    if (num_positional == 2) {
+        iter_double = strtod(positional[1], &endptr);
         if (*endptr != '\0') {
             printf("Incorrect maximum iteration!\n");  
             return 0;
@@ -100,6 +350,110 @@ int validate_input(int argc, char *argv[], int *k, int *iterations) {
     return 1;
 }
 
+/*
+ * Arguments starting with "--" are options; everything else is taken as
+ * the positional k and max_iter, of which at most two are allowed.
+ */
+int parse_options(int argc, char *argv[], char **positional, int *num_positional, kmeans_options *options) {
+    int i = 0;
+
+    options->coreset_size = 0;
+    options->checkpoint_path = NULL;
+    options->checkpoint_every = 0;
+    options->resume_path = NULL;
+    options->bisecting = 0;
+    options->refine = 0;
+    options->quantize = QUANTIZE_NONE;
+    options->threads = default_thread_count();
+    options->numa = 0;
+    options->hugepages = 0;
+    *num_positional = 0;
+
+    for (i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--", 2) != 0) {
+            if (*num_positional == 2) {
+                return 0;
+            }
+            positional[(*num_positional)++] = argv[i];
+        } else if (strcmp(argv[i], "--coreset") == 0 && i + 1 < argc) {
+            if (!parse_positive_int(argv[++i], &options->coreset_size)) {
+                return 0;
+            }
+        } else if (strcmp(argv[i], "--checkpoint") == 0 && i + 1 < argc) {
+            options->checkpoint_path = argv[++i];
+        } else if (strcmp(argv[i], "--checkpoint-every") == 0 && i + 1 < argc) {
+            if (!parse_positive_int(argv[++i], &options->checkpoint_every)) {
+                return 0;
+            }
+        } else if (strcmp(argv[i], "--resume") == 0 && i + 1 < argc) {
+            options->resume_path = argv[++i];
+        } else if (strcmp(argv[i], "--bisecting") == 0) {
+            options->bisecting = 1;
+        } else if (strcmp(argv[i], "--refine") == 0) {
+            options->refine = 1;
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            if (!parse_positive_int(argv[++i], &options->threads) || options->threads > MAX_THREADS) {
+                return 0;
+            }
+        } else if (strcmp(argv[i], "--numa") == 0) {
+            options->numa = 1;
+        } else if (strcmp(argv[i], "--hugepages") == 0) {
+            options->hugepages = 1;
+        } else if (strcmp(argv[i], "--quantize") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "f16") == 0) {
+                options->quantize = QUANTIZE_F16;
+            } else if (strcmp(argv[i], "int8") == 0) {
+                options->quantize = QUANTIZE_INT8;
+            } else {
+                return 0;
+            }
+        } else {
+            return 0;
+        }
+    }
+
+    if (options->checkpoint_every > 0 && !options->checkpoint_path) {
+        return 0;
+    }
+
+    /* checkpoints cover the flat Lloyd loop, which bisecting only runs with --refine */
+    if ((options->refine && !options->bisecting)
+            || (options->bisecting && !options->refine && (options->checkpoint_path || options->resume_path))) {
+        return 0;
+    }
+    if (options->checkpoint_every == 0) {
+        options->checkpoint_every = DEFAULT_CHECKPOINT_EVERY;
+    }
+
+    return 1;
+}
+
+int default_thread_count(void) {
+#ifdef KMEANS_THREADS
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (online < 1) return 1;
+    if (online > MAX_THREADS) return MAX_THREADS;
+    return (int)online;
+#else
+    return 1;
+#endif
+}
+
+int parse_positive_int(const char *s, int *value) {
+    char *endptr;
+    long parsed;
+
+    parsed = strtol(s, &endptr, 10);
+    if (endptr == s || *endptr != '\0' || parsed < 1 || parsed > 2147483647L) {
+        return 0;
+    }
+
+    *value = (int)parsed;
+    return 1;
+}
+
 int is_number(double val) {
     if (val != val || val == HUGE_VAL || val == -HUGE_VAL) {
         return 0;
@@ -118,263 +472,2114 @@ int count_commas(const char *s) {
     return count;
 }
 
-double **load_input(int *num_vectors_ptr, int *dimension_ptr) {
-    char line[MAX_LINE_LENGTH];
-    double **vectors = NULL;
-    int vector_count = 0;
-    int dim = 0;
-    int capacity = INITIAL_CAPACITY;
-    int len = 0;
-    double val = 0.0;
-    int chars_read = 0;
-    int i = 0;
-    double **new_vectors;
-    double *vec;
-    const char *p;
+/*
+ * Reads stdin into one NUL-terminated buffer. When stdin is a regular file
+ * its size is known up front, so the buffer is allocated once at that size
+ * instead of being doubled while reading.
+ */
+char *read_all_input(size_t *length_ptr) {
+    char *buffer;
+    char *new_buffer;
+    size_t capacity = READ_CHUNK_SIZE;
+    size_t length = 0;
+    size_t bytes_read = 0;
+#ifdef __linux__
+    struct stat info;
 
-    vectors = malloc(capacity * sizeof(double*));
-    if (!vectors) {
-        printf("An Error Has Occurred\n");
-        return NULL;
+    if (fstat(fileno(stdin), &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0) {
+        capacity = (size_t)info.st_size + 1;
     }
+#endif
 
-    while (fgets(line, MAX_LINE_LENGTH, stdin)) {
-        len = 0;
-        i = 0;
+    buffer = malloc(capacity + 1);
+    if (!buffer) {
+        return NULL;
+    }
 
-        while (line[len] != '\0') {
-            if (line[len] == '\n') {
-                line[len] = '\0';
-                break;
+    while ((bytes_read = fread(buffer + length, 1, capacity - length, stdin)) > 0) {
+        length += bytes_read;
+        if (length == capacity) {
+            capacity *= 2;
+            new_buffer = realloc(buffer, capacity + 1);
+            if (!new_buffer) {
+                free(buffer);
+                return NULL;
             }
-            len++;
+            buffer = new_buffer;
         }
+    }
 
-        if (line[0] == '\0') continue; 
+    if (ferror(stdin)) {
+        free(buffer);
+        return NULL;
+    }
 
-        if (vector_count == 0) {
-            dim = count_commas(line) + 1;
-            if (dim <= 0) {
-                printf("An Error Has Occurred\n");
-                free(vectors);
-                return NULL;
-            }
-            *dimension_ptr = dim;
+    buffer[length] = '\0';
+    *length_ptr = length;
+    return buffer;
+}
+
+/*
+ * Returns the dimension of the first non-empty line of the NUL-terminated
+ * text, one more than its comma count, or 0 if every line is empty.
+ */
+int detect_dimension(char *text) {
+    char *line = text;
+    char *newline;
+    int dimension = 0;
+
+    while (*line == '\n') line++;
+    if (*line == '\0') {
+        return 0;
+    }
+    newline = strchr(line, '\n');
+    if (newline) *newline = '\0';
+    dimension = count_commas(line) + 1;
+    if (newline) *newline = '\n';
+    return dimension;
+}
+
+int parse_vector_line(const char *line, double *vec, int dim) {
+    const char *p = line;
+    char *endptr;
+    double val = 0.0;
+    int i = 0;
+
+    while (i < dim) {
+        val = strtod(p, &endptr);
+        if (endptr == p || !is_number(val)) {
+            return 0;
         }
+        vec[i++] = val;
 
-        if (vector_count == capacity) {
-            capacity *= 2;
-            new_vectors = realloc(vectors, capacity * sizeof(double*));
-            if (!new_vectors) {
-                printf("An Error Has Occurred\n");
-                free_vectors_array(vectors, vector_count);
-                return NULL;
+        p = endptr;
+        if (i < dim) {
+            if (*p != ',') {
+                return 0;
             }
-            vectors = new_vectors;
+            p += 1;
         }
+    }
 
-        vec = malloc(dim * sizeof(double));
-        if (!vec) {
-            printf("An Error Has Occurred\n");
-            free_vectors_array(vectors, vector_count);
-            return NULL;
+    while (*p == ' ') p += 1;
+    return *p == '\0';
+}
+
+/*
+ * Splits the text into chunks of about PARSE_CHUNK_SIZE bytes, each ending
+ * right after a newline, and returns how many there are. The boundaries go
+ * to starts[0..count], so chunk c spans [starts[c], starts[c + 1]).
+ */
+size_t split_chunks(const char *buffer, size_t length, size_t **starts_ptr) {
+    size_t *starts;
+    size_t count = 0;
+    size_t position = 0;
+    const char *newline;
+
+    starts = malloc((length / PARSE_CHUNK_SIZE + 2) * sizeof(size_t));
+    if (!starts) {
+        return 0;
+    }
+
+    while (position < length) {
+        starts[count++] = position;
+        if (length - position <= PARSE_CHUNK_SIZE) {
+            position = length;
+        } else {
+            newline = memchr(buffer + position + PARSE_CHUNK_SIZE, '\n', length - position - PARSE_CHUNK_SIZE);
+            position = newline ? (size_t)(newline - buffer) + 1 : length;
         }
+    }
+    starts[count] = length;
 
-        p = line;
-        while (i < dim) {
-            chars_read = 0;
-            if (sscanf(p, " %lf%n", &val, &chars_read) != 1 || val != val || val == HUGE_VAL || val == -HUGE_VAL) {
-                printf("An Error Has Occurred\n");
-                free(vec);
-                free_vectors_array(vectors, vector_count);
-                return NULL;
-            }
-            vec[i++] = val;
+    *starts_ptr = starts;
+    return count;
+}
 
-            p += chars_read;
-            if (i < dim) {
-                if (*p != ',') {
-                    printf("An Error Has Occurred\n");
-                    free(vec);
-                    free_vectors_array(vectors, vector_count);
-                    return NULL;
-                }
-                p += 1;
+void count_chunk_rows(void *arg, int thread_index, int num_threads) {
+    parse_task *task = arg;
+    const char *line;
+    const char *end;
+    const char *newline;
+    size_t start;
+    size_t stop;
+    size_t c;
+
+    shard_range(task->num_chunks, thread_index, num_threads, &start, &stop);
+    for (c = start; c < stop; c++) {
+        task->chunk_rows[c] = 0;
+        end = task->buffer + task->chunk_starts[c + 1];
+        for (line = task->buffer + task->chunk_starts[c]; line < end; line = newline + 1) {
+            newline = memchr(line, '\n', end - line);
+            if (!newline) {
+                newline = end;
+            }
+            if (newline > line) {
+                task->chunk_rows[c]++;
             }
         }
+    }
+}
 
-        while (*p == ' ') p += 1;
-        if (*p != '\0') {
-            printf("An Error Has Occurred\n");
-            free(vec);
-            free_vectors_array(vectors, vector_count);
-            return NULL;
-        }
+/*
+ * Parses the chunks whose rows fall in this thread's shard of the vector
+ * block, so each row is first written by the thread that later assigns it.
+ * Chunks know their first row from the counting pass, which keeps input
+ * order no matter which thread parses them. A streamed batch is sharded on
+ * its own rows, which start at first_row.
+ * For quantized storage each row is parsed into the thread's scratch row
+ * and encoded from there; with scan_range set the rows only widen the
+ * thread's per-dimension range, which int8 needs before it can encode.
+ */
+void parse_chunks(void *arg, int thread_index, int num_threads) {
+    parse_task *task = arg;
+    char *line;
+    char *end;
+    char *newline;
+    double *values;
+    double *range_min = NULL;
+    double *range_max = NULL;
+    size_t start;
+    size_t stop;
+    size_t row;
+    size_t c;
+    int parsed = 0;
+    int d = 0;
 
-        vectors[vector_count++] = vec;
+    if (task->scan_range) {
+        range_min = task->range_min + (size_t)thread_index * task->dimension;
+        range_max = task->range_max + (size_t)thread_index * task->dimension;
     }
 
-    if (vector_count == 0) {
-        printf("An Error Has Occurred\n");
-        free(vectors);
-        return NULL;
-    }
+    shard_rows(task->num_rows, thread_index, num_threads, &start, &stop);
+    for (c = 0; c < task->num_chunks; c++) {
+        row = task->chunk_first_row[c];
+        if (task->chunk_rows[c] == 0 || row - task->first_row < start || row - task->first_row >= stop) continue;
 
-    *num_vectors_ptr = vector_count;
-    return vectors;
-}
+        end = task->buffer + task->chunk_starts[c + 1];
+        for (line = task->buffer + task->chunk_starts[c]; line < end; line = newline + 1) {
+            newline = memchr(line, '\n', end - line);
+            if (!newline) {
+                newline = end;
+            }
+            if (newline == line) continue;
 
-double euclidean_distance(double *point1, double *point2, int dimension) {
-    double sum = 0.0;
-    double diff;
-    int i;
-    
-    for (i = 0; i < dimension; i++) {
-        diff = point1[i] - point2[i];
-        sum += diff * diff;
+            values = task->data ? task->data + row * task->dimension : task->scratch + (size_t)thread_index * task->dimension;
+            *newline = '\0';
+            parsed = parse_vector_line(line, values, task->dimension);
+            /* int8 parses the text twice, so the line break is put back */
+            if (newline < end) *newline = '\n';
+            if (!parsed) {
+                task->chunk_failed[c] = 1;
+                break;
+            }
+
+            if (task->scan_range) {
+                for (d = 0; d < task->dimension; d++) {
+                    if (values[d] < range_min[d]) range_min[d] = values[d];
+                    if (values[d] > range_max[d]) range_max[d] = values[d];
+                }
+            } else if (!task->data) {
+                encode_row(task->target, row, values, &task->chunk_squared_error[c], &task->chunk_max_error[c]);
+            }
+            row++;
+        }
     }
-    
-    return sqrt(sum);
 }
 
-void kmeans(double **vectors, int num_vectors, int dimension, int k, int iterations) {
-    double **centroids;
-    double **new_centroids_sum;
-    int *cluster_counts;
-    int *assignments;
+/*
+ * Reads all of stdin, then parses it on the thread pool: the text is cut
+ * into newline-aligned chunks, one parallel pass counts the rows of each
+ * chunk so the storage can be allocated at its exact size, and a second
+ * pass parses every chunk straight into its rows. With --quantize int8 the
+ * rows are encoded as they are parsed, so the double matrix is never
+ * allocated, after one extra pass over the text finds each dimension's
+ * range; that second look is why int8 keeps the whole text. float16 needs
+ * no range and goes to load_streamed_input instead. The RMS and maximum
+ * coordinate error of the encoding, measured against the parsed values, is
+ * reported on stderr.
+ */
+dataset *load_input(const kmeans_options *options, thread_pool *pool) {
+    char *buffer;
+    size_t length = 0;
+    size_t total_rows = 0;
+    size_t count = 0;
+    size_t c = 0;
+    dataset *data;
+    double min_value = 0.0;
+    double max_value = 0.0;
+    double squared_error = 0.0;
+    double max_error = 0.0;
+    int failed = 0;
     int i = 0;
-    int j = 0;
-    int iter = 0;
-    int c = 0;
     int d = 0;
-    int v = 0;
-    int cluster;
-    double min_distance_sq; 
-    int best_cluster = 0;
-    double current_distance_sq = 0.0;
-    double diff = 0.0;
-    int converged = 0;
-    double centroid_distance = 0.0;
+    parse_task task;
 
-    centroids = malloc(k * sizeof(double*));
-    new_centroids_sum = malloc(k * sizeof(double*));
-    cluster_counts = calloc(k, sizeof(int));
-    assignments = calloc(num_vectors, sizeof(int)); 
+    if (options->quantize == QUANTIZE_F16) {
+        return load_streamed_input(options, pool);
+    }
 
-    if (!centroids || !new_centroids_sum || !cluster_counts || !assignments) {
+    buffer = read_all_input(&length);
+    if (!buffer) {
         printf("An Error Has Occurred\n");
-        if (centroids) free(centroids);
-        if (new_centroids_sum) free(new_centroids_sum);
-        free(cluster_counts);
-        free(assignments);
-        return;
+        return NULL;
     }
 
-    for (i = 0; i < k; i++) {
-        centroids[i] = NULL;
-        new_centroids_sum[i] = NULL;
+    task.dimension = detect_dimension(buffer);
+    if (task.dimension == 0) {
+        printf("An Error Has Occurred\n");
+        free(buffer);
+        return NULL;
     }
 
-    for (i = 0; i < k; i++) {
-        centroids[i] = malloc(dimension * sizeof(double));
-        new_centroids_sum[i] = malloc(dimension * sizeof(double));
-        if (!centroids[i] || !new_centroids_sum[i]) {
-            printf("An Error Has Occurred\n");
-            for (j = 0; j < k; j++) {
-                if (centroids[j]) free(centroids[j]);
-                if (new_centroids_sum[j]) free(new_centroids_sum[j]);
+    data = calloc(1, sizeof(dataset));
+    task.buffer = buffer;
+    task.chunk_starts = NULL;
+    task.num_chunks = split_chunks(buffer, length, &task.chunk_starts);
+    task.chunk_rows = malloc(task.num_chunks * sizeof(size_t));
+    task.chunk_first_row = malloc(task.num_chunks * sizeof(size_t));
+    task.chunk_failed = calloc(task.num_chunks, sizeof(int));
+    task.first_row = 0;
+    task.data = NULL;
+    task.target = data;
+    task.scan_range = 0;
+    task.scratch = NULL;
+    task.range_min = NULL;
+    task.range_max = NULL;
+    task.chunk_squared_error = NULL;
+    task.chunk_max_error = NULL;
+    if (!data || task.num_chunks == 0 || !task.chunk_rows || !task.chunk_first_row || !task.chunk_failed) {
+        failed = 1;
+    }
+
+    if (!failed) {
+        run_parallel(pool, count_chunk_rows, &task, (int)task.num_chunks);
+        for (c = 0; c < task.num_chunks; c++) {
+            task.chunk_first_row[c] = total_rows;
+            total_rows += task.chunk_rows[c];
+        }
+        task.num_rows = total_rows;
+        count = total_rows * task.dimension;
+
+        data->format = options->quantize;
+        data->num_vectors = (int)total_rows;
+        data->dimension = task.dimension;
+        if (data->format == QUANTIZE_NONE) {
+            task.data = allocate_vector_data(count * sizeof(double), options->hugepages);
+            failed = !task.data;
+        } else {
+            task.scratch = malloc((size_t)MAX_THREADS * task.dimension * sizeof(double));
+            task.chunk_squared_error = calloc(task.num_chunks, sizeof(double));
+            task.chunk_max_error = calloc(task.num_chunks, sizeof(double));
+            data->codes = allocate_vector_data(count * sizeof(signed char), options->hugepages);
+            data->scale = malloc(task.dimension * sizeof(double));
+            data->offset = malloc(task.dimension * sizeof(double));
+            task.range_min = malloc((size_t)MAX_THREADS * task.dimension * sizeof(double));
+            task.range_max = malloc((size_t)MAX_THREADS * task.dimension * sizeof(double));
+            failed = !task.scratch || !task.chunk_squared_error || !task.chunk_max_error;
+            failed = failed || !data->codes || !data->scale || !data->offset || !task.range_min || !task.range_max;
+        }
+    }
+
+    /* int8 maps each dimension's [min, max] onto the 256 codes */
+    if (!failed && data->format == QUANTIZE_INT8) {
+        for (i = 0; i < MAX_THREADS * task.dimension; i++) {
+            task.range_min[i] = HUGE_VAL;
+            task.range_max[i] = -HUGE_VAL;
+        }
+        task.scan_range = 1;
+        run_parallel(pool, parse_chunks, &task, (int)num_row_blocks(total_rows));
+        task.scan_range = 0;
+        for (c = 0; c < task.num_chunks; c++) {
+            if (task.chunk_failed[c]) failed = 1;
+        }
+        for (d = 0; !failed && d < task.dimension; d++) {
+            min_value = HUGE_VAL;
+            max_value = -HUGE_VAL;
+            for (i = 0; i < MAX_THREADS; i++) {
+                if (task.range_min[i * task.dimension + d] < min_value) min_value = task.range_min[i * task.dimension + d];
+                if (task.range_max[i * task.dimension + d] > max_value) max_value = task.range_max[i * task.dimension + d];
             }
-            free(centroids);
-            free(new_centroids_sum);
-            free(cluster_counts);
-            free(assignments);
-            return;
+            data->scale[d] = (max_value - min_value) / 255.0;
+            data->offset[d] = min_value + 128.0 * data->scale[d];
         }
     }
 
-    for (i = 0; i < k; i++) {
-        for (j = 0; j < dimension; j++) {
-            centroids[i][j] = vectors[i][j];
+    if (!failed) {
+        run_parallel(pool, parse_chunks, &task, (int)num_row_blocks(total_rows));
+        for (c = 0; c < task.num_chunks; c++) {
+            if (task.chunk_failed[c]) failed = 1;
         }
     }
 
-    for (iter = 0; iter < iterations; iter++) {
-        for (c = 0; c < k; c++) {
-            for (d = 0; d < dimension; d++) {
-                new_centroids_sum[c][d] = 0.0;
-            }
-            cluster_counts[c] = 0;
+    /* chunk errors are combined in input order so the report does not depend on the thread count */
+    if (!failed && data->format != QUANTIZE_NONE) {
+        for (c = 0; c < task.num_chunks; c++) {
+            squared_error += task.chunk_squared_error[c];
+            if (task.chunk_max_error[c] > max_error) max_error = task.chunk_max_error[c];
         }
+        fprintf(stderr, "Quantization error: rms %.6f, max %.6f\n", sqrt(squared_error / count), max_error);
+    }
 
-        for (v = 0; v < num_vectors; v++) {
-            best_cluster = 0;
-            min_distance_sq = 1e308; 
-            for (c = 0; c < k; c++) {
-                current_distance_sq = 0.0;
-                for (d = 0; d < dimension; d++) {
-                    diff = vectors[v][d] - centroids[c][d];
-                    current_distance_sq += diff * diff;
-                }
+    free(buffer);
+    free(task.chunk_starts);
+    free(task.chunk_rows);
+    free(task.chunk_first_row);
+    free(task.chunk_failed);
+    free(task.scratch);
+    free(task.range_min);
+    free(task.range_max);
+    free(task.chunk_squared_error);
+    free(task.chunk_max_error);
+
+    if (failed) {
+        printf("An Error Has Occurred\n");
+        free(task.data);
+        free_dataset(data);
+        return NULL;
+    }
 
-                if (current_distance_sq < min_distance_sq) {
-                    min_distance_sq = current_distance_sq;
-                    best_cluster = c;
+    data->values = task.data;
+    return data;
+}
+
+/*
+ * Loads float16 storage without ever holding the whole text. stdin is read
+ * in batches of about STREAM_BATCH_SIZE bytes, each cut after its last
+ * complete line, and every batch is counted, parsed and encoded on the
+ * thread pool the way load_input handles its single buffer before the
+ * next batch overwrites its text; the unfinished line carries over. When
+ * stdin is a regular file its size bounds the row count, since a row
+ * takes at least two bytes per coordinate, so the code block is allocated
+ * once and only the pages that rows land in are ever touched; otherwise
+ * the block doubles as batches arrive.
+ */
+dataset *load_streamed_input(const kmeans_options *options, thread_pool *pool) {
+    char *buffer;
+    char *new_buffer;
+    unsigned short *halves;
+    size_t capacity = STREAM_BATCH_SIZE;
+    size_t length = 0;
+    size_t cut = 0;
+    size_t bytes_read = 0;
+    size_t total_rows = 0;
+    size_t batch_rows = 0;
+    size_t row_capacity = 0;
+    size_t row_bound = 0;
+    size_t c = 0;
+    dataset *data;
+    double squared_error = 0.0;
+    double max_error = 0.0;
+    char saved = '\0';
+    int at_end = 0;
+    int failed = 0;
+    parse_task task;
+#ifdef __linux__
+    struct stat info;
+#endif
+
+    buffer = malloc(capacity + 1);
+    data = calloc(1, sizeof(dataset));
+    task.buffer = NULL;
+    task.chunk_starts = NULL;
+    task.num_chunks = 0;
+    task.chunk_rows = NULL;
+    task.chunk_first_row = NULL;
+    task.chunk_failed = NULL;
+    task.first_row = 0;
+    task.num_rows = 0;
+    task.dimension = 0;
+    task.data = NULL;
+    task.target = data;
+    task.scan_range = 0;
+    task.scratch = NULL;
+    task.range_min = NULL;
+    task.range_max = NULL;
+    task.chunk_squared_error = NULL;
+    task.chunk_max_error = NULL;
+    if (!buffer || !data) {
+        failed = 1;
+    } else {
+        data->format = QUANTIZE_F16;
+    }
+
+    while (!failed && !at_end) {
+        while (length < capacity && (bytes_read = fread(buffer + length, 1, capacity - length, stdin)) > 0) {
+            length += bytes_read;
+        }
+        if (ferror(stdin)) {
+            failed = 1;
+            break;
+        }
+        at_end = length < capacity;
+
+        cut = length;
+        if (!at_end) {
+            while (cut > 0 && buffer[cut - 1] != '\n') cut--;
+            /* a single line fills the batch, so the batch grows until the line ends */
+            if (cut == 0) {
+                capacity *= 2;
+                new_buffer = realloc(buffer, capacity + 1);
+                if (!new_buffer) {
+                    failed = 1;
+                    break;
                 }
+                buffer = new_buffer;
+                continue;
             }
-            assignments[v] = best_cluster;
         }
 
-        for (v = 0; v < num_vectors; v++) {
-            cluster = assignments[v];
-            for (d = 0; d < dimension; d++) {
-                new_centroids_sum[cluster][d] += vectors[v][d];
+        saved = buffer[cut];
+        buffer[cut] = '\0';
+        if (task.dimension == 0) {
+            task.dimension = detect_dimension(buffer);
+            data->dimension = task.dimension;
+            if (task.dimension > 0) {
+                task.scratch = malloc((size_t)MAX_THREADS * task.dimension * sizeof(double));
+                failed = !task.scratch;
+#ifdef __linux__
+                if (fstat(fileno(stdin), &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0) {
+                    row_bound = ((size_t)info.st_size + 1) / (2 * task.dimension) + 1;
+                }
+#endif
             }
-            cluster_counts[cluster]++;
         }
 
-        converged = 1;
-        for (c = 0; c < k; c++) {
-            if (cluster_counts[c] > 0) {
-                for (d = 0; d < dimension; d++) {
-                    new_centroids_sum[c][d] /= cluster_counts[c];
+        if (!failed && task.dimension > 0 && cut > 0) {
+            task.buffer = buffer;
+            task.num_chunks = split_chunks(buffer, cut, &task.chunk_starts);
+            task.chunk_rows = malloc(task.num_chunks * sizeof(size_t));
+            task.chunk_first_row = malloc(task.num_chunks * sizeof(size_t));
+            task.chunk_failed = calloc(task.num_chunks, sizeof(int));
+            task.chunk_squared_error = calloc(task.num_chunks, sizeof(double));
+            task.chunk_max_error = calloc(task.num_chunks, sizeof(double));
+            failed = task.num_chunks == 0 || !task.chunk_rows || !task.chunk_first_row || !task.chunk_failed;
+            failed = failed || !task.chunk_squared_error || !task.chunk_max_error;
+
+            if (!failed) {
+                run_parallel(pool, count_chunk_rows, &task, (int)task.num_chunks);
+                batch_rows = 0;
+                for (c = 0; c < task.num_chunks; c++) {
+                    task.chunk_first_row[c] = total_rows + batch_rows;
+                    batch_rows += task.chunk_rows[c];
                 }
-                
-                centroid_distance = euclidean_distance(centroids[c], new_centroids_sum[c], dimension);
-                if (centroid_distance > EPSILON) {
-                    converged = 0;
+
+                if (total_rows + batch_rows > row_capacity) {
+                    row_capacity = 2 * row_capacity > row_bound ? 2 * row_capacity : row_bound;
+                    if (total_rows + batch_rows > row_capacity) row_capacity = total_rows + batch_rows;
+                    halves = allocate_vector_data(row_capacity * task.dimension * sizeof(unsigned short), options->hugepages);
+                    if (!halves) {
+                        failed = 1;
+                    } else {
+                        if (total_rows > 0) memcpy(halves, data->halves, total_rows * task.dimension * sizeof(unsigned short));
+                        free(data->halves);
+                        data->halves = halves;
+                    }
                 }
-                
-                for (d = 0; d < dimension; d++) {
-                    centroids[c][d] = new_centroids_sum[c][d];
+            }
+
+            if (!failed) {
+                task.first_row = total_rows;
+                task.num_rows = batch_rows;
+                run_parallel(pool, parse_chunks, &task, (int)num_row_blocks(batch_rows));
+                /* chunk errors are combined in input order so the report does not depend on the thread count */
+                for (c = 0; c < task.num_chunks; c++) {
+                    if (task.chunk_failed[c]) failed = 1;
+                    squared_error += task.chunk_squared_error[c];
+                    if (task.chunk_max_error[c] > max_error) max_error = task.chunk_max_error[c];
                 }
-            } else {
-                printf("An Error Has Occurred\n");
+                total_rows += batch_rows;
             }
+
+            free(task.chunk_starts);
+            free(task.chunk_rows);
+            free(task.chunk_first_row);
+            free(task.chunk_failed);
+            free(task.chunk_squared_error);
+            free(task.chunk_max_error);
+            task.chunk_starts = NULL;
+            task.chunk_rows = NULL;
+            task.chunk_first_row = NULL;
+            task.chunk_failed = NULL;
+            task.chunk_squared_error = NULL;
+            task.chunk_max_error = NULL;
         }
 
-        if (converged && iter > 0) { 
-            break;
+        buffer[cut] = saved;
+        memmove(buffer, buffer + cut, length - cut);
+        length -= cut;
+    }
+
+    free(buffer);
+    free(task.scratch);
+
+    if (failed || total_rows == 0) {
+        printf("An Error Has Occurred\n");
+        free_dataset(data);
+        return NULL;
+    }
+
+    data->num_vectors = (int)total_rows;
+    fprintf(stderr, "Quantization error: rms %.6f, max %.6f\n", sqrt(squared_error / (total_rows * task.dimension)), max_error);
+    return data;
+}
+
+/*
+ * The vector block is allocated once, before anything is written to it.
+ * With hugepages set, blocks of at least HUGEPAGE_SIZE are aligned to a
+ * huge page and flagged for transparent huge pages on Linux, which cuts
+ * TLB misses when the assignment loop streams over large inputs.
+ */
+void *allocate_vector_data(size_t bytes, int hugepages) {
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+    void *aligned = NULL;
+
+    if (hugepages && bytes >= HUGEPAGE_SIZE && posix_memalign(&aligned, HUGEPAGE_SIZE, bytes) == 0) {
+        madvise(aligned, bytes, MADV_HUGEPAGE);
+        return aligned;
+    }
+#else
+    (void)hugepages;
+#endif
+    return malloc(bytes);
+}
+
+#ifdef KMEANS_THREADS
+/*
+ * Lists the CPUs the process may run on, so pinned workers can be spread
+ * over them before any thread's own affinity has been narrowed. The list
+ * takes one CPU from each NUMA node in turn, so even a few threads cover
+ * every node instead of filling node 0 first. CPUs that sysfs does not
+ * place on a node, or all of them without sysfs, follow in mask order.
+ */
+int allowed_cpus(int *cpus, int max_cpus) {
+    cpu_set_t allowed;
+    cpu_set_t nodes[MAX_NUMA_NODES];
+    int next[MAX_NUMA_NODES];
+    int num_nodes = 0;
+    int count = 0;
+    int added = 0;
+    int node = 0;
+    int cpu = 0;
+
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+        return 0;
+    }
+
+    for (node = 0; node < MAX_NUMA_NODES; node++) {
+        if (read_node_cpus(node, &nodes[num_nodes])) {
+            CPU_AND(&nodes[num_nodes], &nodes[num_nodes], &allowed);
+            next[num_nodes] = 0;
+            num_nodes++;
         }
     }
 
-    print_result(centroids, k, dimension);
-    for (i = 0; i < k; i++) {
-        free(centroids[i]);
-        free(new_centroids_sum[i]);
+    do {
+        added = 0;
+        for (node = 0; node < num_nodes && count < max_cpus; node++) {
+            for (cpu = next[node]; cpu < CPU_SETSIZE && !CPU_ISSET(cpu, &nodes[node]); cpu++) {
+            }
+            next[node] = cpu + 1;
+            if (cpu < CPU_SETSIZE) {
+                cpus[count++] = cpu;
+                CPU_CLR(cpu, &allowed);
+                added = 1;
+            }
+        }
+    } while (added && count < max_cpus);
+
+    for (cpu = 0; cpu < CPU_SETSIZE && count < max_cpus; cpu++) {
+        if (CPU_ISSET(cpu, &allowed)) {
+            cpus[count++] = cpu;
+        }
     }
-    free(centroids);
-    free(new_centroids_sum);
-    free(cluster_counts);
-    free(assignments);
+    return count;
+}
+
+/*
+ * Reads the CPUs of one NUMA node from sysfs, a list of ranges such as
+ * "0-31,64-95". Returns 0 if the node does not exist.
+ */
+int read_node_cpus(int node, cpu_set_t *cpus) {
+    char path[64];
+    FILE *file;
+    int first = 0;
+    int last = 0;
+    int cpu = 0;
+    int separator = 0;
+
+    sprintf(path, "/sys/devices/system/node/node%d/cpulist", node);
+    file = fopen(path, "r");
+    if (!file) {
+        return 0;
+    }
+
+    CPU_ZERO(cpus);
+    while (fscanf(file, "%d", &first) == 1) {
+        last = first;
+        separator = fgetc(file);
+        if (separator == '-') {
+            if (fscanf(file, "%d", &last) != 1) break;
+            separator = fgetc(file);
+        }
+        for (cpu = first; cpu >= 0 && cpu <= last && cpu < CPU_SETSIZE; cpu++) {
+            CPU_SET(cpu, cpus);
+        }
+        if (separator != ',') break;
+    }
+
+    fclose(file);
+    return 1;
+}
+
+void pin_thread(thread_pool *pool, int index) {
+    cpu_set_t target;
+
+    if (!pool->pin_threads || pool->num_cpus == 0) {
+        return;
+    }
+
+    CPU_ZERO(&target);
+    CPU_SET(pool->cpus[index % pool->num_cpus], &target);
+    pthread_setaffinity_np(pthread_self(), sizeof(target), &target);
+}
+
+void *thread_pool_worker(void *arg) {
+    thread_worker *worker = arg;
+    thread_pool *pool = worker->pool;
+    unsigned long seen = 0;
+
+    pin_thread(pool, worker->index);
+
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (pool->generation == seen && !pool->shutdown) {
+            pthread_cond_wait(&pool->work_ready, &pool->lock);
+        }
+        if (pool->shutdown) {
+            break;
+        }
+        seen = pool->generation;
+        pthread_mutex_unlock(&pool->lock);
+
+        if (worker->index < pool->active_threads) {
+            pool->task(pool->arg, worker->index, pool->active_threads);
+        }
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->pending == 0) {
+            pthread_cond_signal(&pool->work_done);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+#endif
+
+/*
+ * Starts num_threads - 1 workers; the calling thread acts as worker 0. With
+ * pin_threads every thread is bound to its own CPU, so memory a worker
+ * touches first is placed on its NUMA node and stays local to it. Returns
+ * NULL when threads are unavailable or num_threads is 1, in which case
+ * run_parallel simply runs tasks on the caller.
+ */
+thread_pool *create_thread_pool(int num_threads, int pin_threads) {
+#ifdef KMEANS_THREADS
+    thread_pool *pool;
+    int i = 0;
+
+    if (num_threads <= 1) {
+        return NULL;
+    }
+
+    pool = calloc(1, sizeof(thread_pool));
+    if (!pool) {
+        return NULL;
+    }
+    pool->threads = malloc(num_threads * sizeof(pthread_t));
+    pool->workers = malloc(num_threads * sizeof(thread_worker));
+    pool->cpus = malloc(MAX_THREADS * sizeof(int));
+    if (!pool->threads || !pool->workers || !pool->cpus) {
+        free(pool->threads);
+        free(pool->workers);
+        free(pool->cpus);
+        free(pool);
+        return NULL;
+    }
+
+    pool->pin_threads = pin_threads;
+    pool->num_cpus = pin_threads ? allowed_cpus(pool->cpus, MAX_THREADS) : 0;
+    pool->num_threads = 1;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work_ready, NULL);
+    pthread_cond_init(&pool->work_done, NULL);
+
+    for (i = 1; i < num_threads; i++) {
+        pool->workers[i].pool = pool;
+        pool->workers[i].index = i;
+        if (pthread_create(&pool->threads[i], NULL, thread_pool_worker, &pool->workers[i]) != 0) {
+            break;
+        }
+        pool->num_threads++;
+    }
+
+    pin_thread(pool, 0);
+    return pool;
+#else
+    (void)num_threads;
+    (void)pin_threads;
+    return NULL;
+#endif
+}
+
+void destroy_thread_pool(thread_pool *pool) {
+#ifdef KMEANS_THREADS
+    int i = 0;
+
+    if (!pool) {
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->shutdown = 1;
+    pthread_cond_broadcast(&pool->work_ready);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (i = 1; i < pool->num_threads; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->work_ready);
+    pthread_cond_destroy(&pool->work_done);
+    free(pool->threads);
+    free(pool->workers);
+    free(pool->cpus);
+    free(pool);
+#else
+    (void)pool;
+#endif
+}
+
+/*
+ * Runs task on up to max_threads threads of the pool and waits for all of
+ * them. Callers pass how many pieces their work splits into, such as
+ * num_row_blocks() for row passes, so small inputs use fewer threads or
+ * stay on the caller.
+ */
+void run_parallel(thread_pool *pool, parallel_task_fn task, void *arg, int max_threads) {
+#ifdef KMEANS_THREADS
+    int active = 1;
+
+    if (pool) {
+        active = max_threads;
+        if (active > pool->num_threads) active = pool->num_threads;
+    }
+
+    if (active <= 1) {
+        task(arg, 0, 1);
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->task = task;
+    pool->arg = arg;
+    pool->active_threads = active;
+    pool->pending = pool->num_threads - 1;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->work_ready);
+    pthread_mutex_unlock(&pool->lock);
+
+    task(arg, 0, active);
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->pending > 0) {
+        pthread_cond_wait(&pool->work_done, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+#else
+    (void)pool;
+    (void)max_threads;
+    task(arg, 0, 1);
+#endif
+}
+
+/* Splits num_items into num_threads contiguous shards; thread_index gets [start, end). */
+void shard_range(size_t num_items, int thread_index, int num_threads, size_t *start_ptr, size_t *end_ptr) {
+    *start_ptr = num_items * thread_index / num_threads;
+    *end_ptr = num_items * (thread_index + 1) / num_threads;
+}
+
+/*
+ * Rows are summed in fixed blocks of at least MIN_ROWS_PER_THREAD rows,
+ * at most MAX_THREADS of them. The block count depends only on the number
+ * of rows, and a thread always takes whole blocks, so the partial sums and
+ * the order they are combined in are the same for any thread count.
+ */
+size_t num_row_blocks(size_t num_rows) {
+    size_t blocks = num_rows / MIN_ROWS_PER_THREAD;
+
+    if (blocks < 1) blocks = 1;
+    if (blocks > MAX_THREADS) blocks = MAX_THREADS;
+    return blocks;
+}
+
+/* The rows of this thread's whole blocks: [start, end). */
+void shard_rows(size_t num_rows, int thread_index, int num_threads, size_t *start_ptr, size_t *end_ptr) {
+    size_t blocks = num_row_blocks(num_rows);
+    size_t first_block;
+    size_t end_block;
+
+    shard_range(blocks, thread_index, num_threads, &first_block, &end_block);
+    *start_ptr = num_rows * first_block / blocks;
+    *end_ptr = num_rows * end_block / blocks;
+}
+
+/*
+ * Assigns this thread's blocks of rows to their nearest centroids and sums
+ * each block into its own slice of block_sums and block_weights, so every
+ * row is read only by the thread on whose node it was first touched. With
+ * replicate set the worker first copies the centroids into memory it
+ * allocates itself, so every NUMA node scans its own replica instead of
+ * pulling the shared centroids across the socket link.
+ */
+void assign_shard(void *arg, int thread_index, int num_threads) {
+    assignment_task *task = arg;
+    double **centroids = task->centroids;
+    double **replica = NULL;
+    double *storage = NULL;
+    double *sums;
+    double *block_weights;
+    double weight = 1.0;
+    size_t num_rows = task->data->num_vectors;
+    size_t first_block;
+    size_t end_block;
+    size_t block;
+    size_t start;
+    size_t end;
+    size_t v;
+    int cluster = 0;
+    int c = 0;
+
+    if (task->replicate) {
+        replica = malloc(task->k * sizeof(double*));
+        storage = malloc((size_t)task->k * task->dimension * sizeof(double));
+        if (replica && storage) {
+            for (c = 0; c < task->k; c++) {
+                replica[c] = storage + (size_t)c * task->dimension;
+                memcpy(replica[c], task->centroids[c], task->dimension * sizeof(double));
+            }
+            centroids = replica;
+        }
+    }
+
+    shard_range(task->num_blocks, thread_index, num_threads, &first_block, &end_block);
+    for (block = first_block; block < end_block; block++) {
+        sums = task->block_sums + block * task->k * task->dimension;
+        block_weights = task->block_weights + block * task->k;
+        memset(sums, 0, (size_t)task->k * task->dimension * sizeof(double));
+        memset(block_weights, 0, task->k * sizeof(double));
+
+        start = num_rows * block / task->num_blocks;
+        end = num_rows * (block + 1) / task->num_blocks;
+        for (v = start; v < end; v++) {
+            cluster = task->nearest(task->data, v, centroids, task->k);
+            weight = task->weights ? task->weights[v] : 1.0;
+            task->accumulate(sums + (size_t)cluster * task->dimension, task->data, v, weight);
+            block_weights[cluster] += weight;
+        }
+    }
+
+    free(replica);
+    free(storage);
+}
+
+double squared_distance(const double *point1, const double *point2, int dimension) {
+    double sum = 0.0;
+    double diff;
+    int i;
+    
+    for (i = 0; i < dimension; i++) {
+        diff = point1[i] - point2[i];
+        sum += diff * diff;
+    }
+    
+    return sum;
+}
+
+double euclidean_distance(double *point1, double *point2, int dimension) {
+    return sqrt(squared_distance(point1, point2, dimension));
+}
+
+/*
+ * Row loads for each storage format. Quantized rows are widened to double
+ * in registers as the kernels read them, so distances are computed straight
+ * from the codes without a decoded copy of the row.
+ */
+#define LOAD_DOUBLE(data, row, d, D) ((data)->values[(row) * (D) + (d)])
+#define LOAD_F16(data, row, d, D) ((double)half_to_float((data)->halves[(row) * (D) + (d)]))
+#define LOAD_INT8(data, row, d, D) ((data)->offset[d] + (data)->scale[d] * (data)->codes[(row) * (D) + (d)])
+
+#define DEFINE_GENERIC_KERNELS(FORMAT, LOAD) \
+static int nearest_centroid_##FORMAT##_generic(const dataset *data, size_t row, double **centroids, int k) { \
+    double min_distance_sq = 1e308; \
+    double current_distance_sq; \
+    double diff; \
+    size_t dimension = data->dimension; \
+    int best_cluster = 0; \
+    int c = 0; \
+    size_t d = 0; \
+    for (c = 0; c < k; c++) { \
+        current_distance_sq = 0.0; \
+        for (d = 0; d < dimension; d++) { \
+            diff = LOAD(data, row, d, dimension) - centroids[c][d]; \
+            current_distance_sq += diff * diff; \
+        } \
+        if (current_distance_sq < min_distance_sq) { \
+            min_distance_sq = current_distance_sq; \
+            best_cluster = c; \
+        } \
+    } \
+    return best_cluster; \
+} \
+static void accumulate_point_##FORMAT##_generic(double *sum, const dataset *data, size_t row, double weight) { \
+    size_t dimension = data->dimension; \
+    size_t d = 0; \
+    for (d = 0; d < dimension; d++) { \
+        sum[d] += weight * LOAD(data, row, d, dimension); \
+    } \
+}
+
+/*
+ * Kernels for a fixed dimension D. The loop bounds are compile-time
+ * constants, so the compiler fully unrolls them and keeps the point in
+ * registers across all k centroids. They sum in the same order as the
+ * generic kernels, so results are bit-identical.
+ */
+#define DEFINE_FIXED_DIMENSION_KERNELS(FORMAT, LOAD, D) \
+static int nearest_centroid_##FORMAT##_##D(const dataset *data, size_t row, double **centroids, int k) { \
+    double p[D]; \
+    double min_distance_sq = 1e308; \
+    double current_distance_sq; \
+    double diff; \
+    const double *centroid; \
+    int best_cluster = 0; \
+    int c = 0; \
+    size_t d = 0; \
+    for (d = 0; d < D; d++) { \
+        p[d] = LOAD(data, row, d, D); \
+    } \
+    for (c = 0; c < k; c++) { \
+        centroid = centroids[c]; \
+        current_distance_sq = 0.0; \
+        for (d = 0; d < D; d++) { \
+            diff = p[d] - centroid[d]; \
+            current_distance_sq += diff * diff; \
+        } \
+        if (current_distance_sq < min_distance_sq) { \
+            min_distance_sq = current_distance_sq; \
+            best_cluster = c; \
+        } \
+    } \
+    return best_cluster; \
+} \
+static void accumulate_point_##FORMAT##_##D(double *sum, const dataset *data, size_t row, double weight) { \
+    size_t d = 0; \
+    for (d = 0; d < D; d++) { \
+        sum[d] += weight * LOAD(data, row, d, D); \
+    } \
+}
+
+#define DEFINE_FORMAT_KERNELS(D) \
+DEFINE_FIXED_DIMENSION_KERNELS(double, LOAD_DOUBLE, D) \
+DEFINE_FIXED_DIMENSION_KERNELS(f16, LOAD_F16, D) \
+DEFINE_FIXED_DIMENSION_KERNELS(int8, LOAD_INT8, D)
+
+DEFINE_GENERIC_KERNELS(double, LOAD_DOUBLE)
+DEFINE_GENERIC_KERNELS(f16, LOAD_F16)
+DEFINE_GENERIC_KERNELS(int8, LOAD_INT8)
+
+DEFINE_FORMAT_KERNELS(1)
+DEFINE_FORMAT_KERNELS(2)
+DEFINE_FORMAT_KERNELS(3)
+DEFINE_FORMAT_KERNELS(4)
+DEFINE_FORMAT_KERNELS(5)
+DEFINE_FORMAT_KERNELS(6)
+DEFINE_FORMAT_KERNELS(7)
+DEFINE_FORMAT_KERNELS(8)
+DEFINE_FORMAT_KERNELS(9)
+DEFINE_FORMAT_KERNELS(10)
+DEFINE_FORMAT_KERNELS(11)
+DEFINE_FORMAT_KERNELS(12)
+DEFINE_FORMAT_KERNELS(13)
+DEFINE_FORMAT_KERNELS(14)
+DEFINE_FORMAT_KERNELS(15)
+DEFINE_FORMAT_KERNELS(16)
+
+#define FIXED_DIMENSION_KERNEL_TABLE(KERNEL, FORMAT) { \
+    NULL, \
+    KERNEL##_##FORMAT##_1, KERNEL##_##FORMAT##_2, KERNEL##_##FORMAT##_3, KERNEL##_##FORMAT##_4, \
+    KERNEL##_##FORMAT##_5, KERNEL##_##FORMAT##_6, KERNEL##_##FORMAT##_7, KERNEL##_##FORMAT##_8, \
+    KERNEL##_##FORMAT##_9, KERNEL##_##FORMAT##_10, KERNEL##_##FORMAT##_11, KERNEL##_##FORMAT##_12, \
+    KERNEL##_##FORMAT##_13, KERNEL##_##FORMAT##_14, KERNEL##_##FORMAT##_15, KERNEL##_##FORMAT##_16 \
+}
+
+/* indexed by storage format (QUANTIZE_NONE, QUANTIZE_F16, QUANTIZE_INT8), then dimension */
+static const nearest_centroid_fn nearest_centroid_kernels[3][MAX_FIXED_DIMENSION + 1] = {
+    FIXED_DIMENSION_KERNEL_TABLE(nearest_centroid, double),
+    FIXED_DIMENSION_KERNEL_TABLE(nearest_centroid, f16),
+    FIXED_DIMENSION_KERNEL_TABLE(nearest_centroid, int8)
+};
+
+static const accumulate_point_fn accumulate_point_kernels[3][MAX_FIXED_DIMENSION + 1] = {
+    FIXED_DIMENSION_KERNEL_TABLE(accumulate_point, double),
+    FIXED_DIMENSION_KERNEL_TABLE(accumulate_point, f16),
+    FIXED_DIMENSION_KERNEL_TABLE(accumulate_point, int8)
+};
+
+static const nearest_centroid_fn nearest_centroid_generic_kernels[3] = {
+    nearest_centroid_double_generic, nearest_centroid_f16_generic, nearest_centroid_int8_generic
+};
+
+static const accumulate_point_fn accumulate_point_generic_kernels[3] = {
+    accumulate_point_double_generic, accumulate_point_f16_generic, accumulate_point_int8_generic
+};
+
+/* The storage format is resolved here once, so the per-row loops never branch on it. */
+void select_kernels(const dataset *data, nearest_centroid_fn *nearest_ptr, accumulate_point_fn *accumulate_ptr) {
+    if (data->dimension >= 1 && data->dimension <= MAX_FIXED_DIMENSION) {
+        *nearest_ptr = nearest_centroid_kernels[data->format][data->dimension];
+        *accumulate_ptr = accumulate_point_kernels[data->format][data->dimension];
+    } else {
+        *nearest_ptr = nearest_centroid_generic_kernels[data->format];
+        *accumulate_ptr = accumulate_point_generic_kernels[data->format];
+    }
+}
+
+/*
+ * Picks the clustering mode from the options: flat Lloyd, started from
+ * initial_centroids when given, or bisecting k-means optionally refined by
+ * flat Lloyd starting from its centroids.
+ */
+double **cluster_points(const dataset *data, double *weights, int k, int iterations, const kmeans_options *options, double **initial_centroids, thread_pool *pool) {
+    double **centroids;
+    double **refined;
+
+    if (!options->bisecting) {
+        return kmeans(data, weights, k, iterations, options, initial_centroids, pool);
+    }
+
+    /* the checkpoint already holds refined centroids, so the bisecting pass is skipped */
+    if (options->resume_path) {
+        return kmeans(data, weights, k, iterations, options, NULL, pool);
+    }
+
+    centroids = bisecting_kmeans(data, weights, k, iterations);
+    if (!centroids || !options->refine) {
+        return centroids;
+    }
+
+    refined = kmeans(data, weights, k, iterations, options, centroids, pool);
+    free_centroids(centroids, k);
+    return refined;
+}
+
+/*
+ * Bisecting k-means: starting from a single cluster, repeatedly splits the
+ * cluster with the highest SSE in two with a 2-means step until there are k
+ * clusters. Each cluster owns a contiguous range of the order[] index array
+ * and a split only partitions that range, so it touches only the cluster's
+ * own points.
+ */
+double **bisecting_kmeans(const dataset *data, double *weights, int k, int iterations) {
+    double **centroids;
+    int num_vectors = data->num_vectors;
+    int dimension = data->dimension;
+    double *sse;
+    double *buffer;
+    int *order;
+    int *starts;
+    int *sizes;
+    int num_clusters = 1;
+    int split = 0;
+    int left_size = 0;
+    int i = 0;
+    int c = 0;
+
+    centroids = calloc(k, sizeof(double*));
+    sse = malloc(k * sizeof(double));
+    order = malloc(num_vectors * sizeof(int));
+    starts = malloc(k * sizeof(int));
+    sizes = malloc(k * sizeof(int));
+    buffer = malloc(dimension * sizeof(double));
+    if (!centroids || !sse || !order || !starts || !sizes || !buffer) {
+        printf("An Error Has Occurred\n");
+        free(centroids);
+        free(sse);
+        free(order);
+        free(starts);
+        free(sizes);
+        free(buffer);
+        return NULL;
+    }
+
+    for (i = 0; i < k; i++) {
+        centroids[i] = malloc(dimension * sizeof(double));
+        if (!centroids[i]) {
+            printf("An Error Has Occurred\n");
+            free_centroids(centroids, k);
+            free(sse);
+            free(order);
+            free(starts);
+            free(sizes);
+            free(buffer);
+            return NULL;
+        }
+    }
+
+    for (i = 0; i < num_vectors; i++) {
+        order[i] = i;
+    }
+    starts[0] = 0;
+    sizes[0] = num_vectors;
+    cluster_mean(data, weights, order, num_vectors, centroids[0]);
+    sse[0] = cluster_sse(data, weights, order, num_vectors, centroids[0], buffer);
+
+    while (num_clusters < k) {
+        split = -1;
+        for (c = 0; c < num_clusters; c++) {
+            if (sizes[c] >= 2 && (split < 0 || sse[c] > sse[split])) {
+                split = c;
+            }
+        }
+
+        left_size = split_cluster(data, weights, order + starts[split], sizes[split], iterations);
+        if (left_size < 0) {
+            printf("An Error Has Occurred\n");
+            free_centroids(centroids, k);
+            free(sse);
+            free(order);
+            free(starts);
+            free(sizes);
+            free(buffer);
+            return NULL;
+        }
+
+        starts[num_clusters] = starts[split] + left_size;
+        sizes[num_clusters] = sizes[split] - left_size;
+        sizes[split] = left_size;
+
+        cluster_mean(data, weights, order + starts[split], sizes[split], centroids[split]);
+        sse[split] = cluster_sse(data, weights, order + starts[split], sizes[split], centroids[split], buffer);
+        cluster_mean(data, weights, order + starts[num_clusters], sizes[num_clusters], centroids[num_clusters]);
+        sse[num_clusters] = cluster_sse(data, weights, order + starts[num_clusters], sizes[num_clusters], centroids[num_clusters], buffer);
+        num_clusters++;
+    }
+
+    free(sse);
+    free(order);
+    free(starts);
+    free(sizes);
+    free(buffer);
+    return centroids;
+}
+
+/*
+ * Runs 2-means on the points listed in members[0..size) and reorders members
+ * so the first cluster's points come first. The two centroids start at the
+ * first member and the member farthest from it, and points are assigned
+ * with the same dimension-specialized kernels as kmeans(). Returns the size
+ * of the first cluster, which is always between 1 and size - 1: if the
+ * points cannot be separated the range is simply cut in half. Returns -1
+ * if memory runs out.
+ */
+int split_cluster(const dataset *data, double *weights, int *members, int size, int iterations) {
+    double *centroids[2];
+    double *sums[2];
+    double cluster_weights[2];
+    double *storage;
+    double *buffer;
+    double distance_sq = 0.0;
+    double farthest_sq = -1.0;
+    double weight = 1.0;
+    int farthest = 0;
+    int side = 0;
+    int converged = 0;
+    int left = 0;
+    int right = 0;
+    int tmp = 0;
+    int iter = 0;
+    int i = 0;
+    int d = 0;
+    int dimension = data->dimension;
+    nearest_centroid_fn nearest_centroid;
+    accumulate_point_fn accumulate_point;
+
+    select_kernels(data, &nearest_centroid, &accumulate_point);
+
+    storage = malloc(5 * dimension * sizeof(double));
+    if (!storage) {
+        return -1;
+    }
+    centroids[0] = storage;
+    centroids[1] = storage + dimension;
+    sums[0] = storage + 2 * dimension;
+    sums[1] = storage + 3 * dimension;
+    buffer = storage + 4 * dimension;
+
+    memcpy(centroids[0], dataset_row(data, members[0], buffer), dimension * sizeof(double));
+    for (i = 0; i < size; i++) {
+        distance_sq = squared_distance(dataset_row(data, members[i], buffer), centroids[0], dimension);
+        if (distance_sq > farthest_sq) {
+            farthest_sq = distance_sq;
+            farthest = i;
+        }
+    }
+    memcpy(centroids[1], dataset_row(data, members[farthest], buffer), dimension * sizeof(double));
+
+    for (iter = 0; iter < iterations; iter++) {
+        for (side = 0; side < 2; side++) {
+            for (d = 0; d < dimension; d++) {
+                sums[side][d] = 0.0;
+            }
+            cluster_weights[side] = 0.0;
+        }
+
+        for (i = 0; i < size; i++) {
+            side = nearest_centroid(data, members[i], centroids, 2);
+            weight = weights ? weights[members[i]] : 1.0;
+            accumulate_point(sums[side], data, members[i], weight);
+            cluster_weights[side] += weight;
+        }
+
+        if (cluster_weights[0] <= 0 || cluster_weights[1] <= 0) {
+            break;
+        }
+
+        converged = 1;
+        for (side = 0; side < 2; side++) {
+            for (d = 0; d < dimension; d++) {
+                sums[side][d] /= cluster_weights[side];
+            }
+            if (euclidean_distance(centroids[side], sums[side], dimension) > EPSILON) {
+                converged = 0;
+            }
+            for (d = 0; d < dimension; d++) {
+                centroids[side][d] = sums[side][d];
+            }
+        }
+
+        if (converged && iter > 0) {
+            break;
+        }
+    }
+
+    /* partition members so the points nearer the first centroid come first */
+    left = 0;
+    right = size - 1;
+    while (left <= right) {
+        if (nearest_centroid(data, members[left], centroids, 2) == 1) {
+            tmp = members[left];
+            members[left] = members[right];
+            members[right] = tmp;
+            right--;
+        } else {
+            left++;
+        }
+    }
+
+    free(storage);
+    if (left == 0 || left == size) {
+        return size / 2;
+    }
+    return left;
+}
+
+void cluster_mean(const dataset *data, double *weights, const int *members, int size, double *mean) {
+    double total_weight = 0.0;
+    double weight = 1.0;
+    int i = 0;
+    int d = 0;
+    nearest_centroid_fn nearest_centroid;
+    accumulate_point_fn accumulate_point;
+
+    select_kernels(data, &nearest_centroid, &accumulate_point);
+    for (d = 0; d < data->dimension; d++) {
+        mean[d] = 0.0;
+    }
+
+    for (i = 0; i < size; i++) {
+        weight = weights ? weights[members[i]] : 1.0;
+        accumulate_point(mean, data, members[i], weight);
+        total_weight += weight;
+    }
+
+    if (total_weight > 0) {
+        for (d = 0; d < data->dimension; d++) {
+            mean[d] /= total_weight;
+        }
+    }
+}
+
+double cluster_sse(const dataset *data, double *weights, const int *members, int size, const double *centroid, double *buffer) {
+    double sse = 0.0;
+    int i = 0;
+
+    for (i = 0; i < size; i++) {
+        sse += (weights ? weights[members[i]] : 1.0) * squared_distance(dataset_row(data, members[i], buffer), centroid, data->dimension);
+    }
+
+    return sse;
+}
+
+/*
+ * Runs Lloyd's algorithm starting from initial_centroids, or from the first
+ * k vectors when it is NULL, and returns the final centroids, which the
+ * caller frees with free_centroids. When weights is non-NULL every vector
+ * counts with its weight in the centroid sums and cluster sizes; NULL
+ * weights mean every vector counts once. With a resume path the centroids
+ * and iteration number come from that checkpoint instead, and with a
+ * checkpoint path the state is saved every checkpoint_every iterations.
+ */
+double **kmeans(const dataset *data, double *weights, int k, int iterations, const kmeans_options *options, double **initial_centroids, thread_pool *pool) {
+    double **centroids;
+    const double *row;
+    int num_vectors = data->num_vectors;
+    int dimension = data->dimension;
+    double **new_centroids_sum;
+    double *cluster_weights;
+    double *block_sums;
+    double *block_weights;
+    size_t num_blocks;
+    size_t block;
+    int i = 0;
+    int j = 0;
+    int iter = 0;
+    int c = 0;
+    int d = 0;
+    int converged = 0;
+    double centroid_distance = 0.0;
+    int first_iteration = 0;
+    unsigned long fingerprint = 0;
+    nearest_centroid_fn nearest_centroid;
+    accumulate_point_fn accumulate_point;
+    assignment_task assignment;
+
+    select_kernels(data, &nearest_centroid, &accumulate_point);
+
+    centroids = malloc(k * sizeof(double*));
+    new_centroids_sum = malloc(k * sizeof(double*));
+    cluster_weights = calloc(k, sizeof(double));
+    num_blocks = num_row_blocks(num_vectors);
+    block_sums = malloc(num_blocks * k * dimension * sizeof(double));
+    block_weights = malloc(num_blocks * k * sizeof(double));
+
+    if (!centroids || !new_centroids_sum || !cluster_weights || !block_sums || !block_weights) {
+        printf("An Error Has Occurred\n");
+        if (centroids) free(centroids);
+        if (new_centroids_sum) free(new_centroids_sum);
+        free(cluster_weights);
+        free(block_sums);
+        free(block_weights);
+        return NULL;
+    }
+
+    for (i = 0; i < k; i++) {
+        centroids[i] = NULL;
+        new_centroids_sum[i] = NULL;
+    }
+
+    for (i = 0; i < k; i++) {
+        centroids[i] = malloc(dimension * sizeof(double));
+        new_centroids_sum[i] = malloc(dimension * sizeof(double));
+        if (!centroids[i] || !new_centroids_sum[i]) {
+            printf("An Error Has Occurred\n");
+            for (j = 0; j < k; j++) {
+                if (centroids[j]) free(centroids[j]);
+                if (new_centroids_sum[j]) free(new_centroids_sum[j]);
+            }
+            free(centroids);
+            free(new_centroids_sum);
+            free(cluster_weights);
+            free(block_sums);
+            free(block_weights);
+            return NULL;
+        }
+    }
+
+    if (options->checkpoint_path || options->resume_path) {
+        fingerprint = fingerprint_input(data, weights);
+    }
+
+    if (options->resume_path) {
+        if (!read_checkpoint(options->resume_path, centroids, k, dimension, num_vectors, fingerprint, &first_iteration)) {
+            printf("An Error Has Occurred\n");
+            free_centroids(centroids, k);
+            free_centroids(new_centroids_sum, k);
+            free(cluster_weights);
+            free(block_sums);
+            free(block_weights);
+            return NULL;
+        }
+    } else {
+        for (i = 0; i < k; i++) {
+            row = initial_centroids ? initial_centroids[i] : dataset_row(data, i, centroids[i]);
+            for (j = 0; j < dimension; j++) {
+                centroids[i][j] = row[j];
+            }
+        }
+    }
+
+    assignment.data = data;
+    assignment.weights = weights;
+    assignment.centroids = centroids;
+    assignment.block_sums = block_sums;
+    assignment.block_weights = block_weights;
+    assignment.num_blocks = num_blocks;
+    assignment.k = k;
+    assignment.dimension = dimension;
+    assignment.replicate = options->numa;
+    assignment.nearest = nearest_centroid;
+    assignment.accumulate = accumulate_point;
+
+    for (iter = first_iteration; iter < iterations; iter++) {
+        for (c = 0; c < k; c++) {
+            for (d = 0; d < dimension; d++) {
+                new_centroids_sum[c][d] = 0.0;
+            }
+            cluster_weights[c] = 0.0;
+        }
+
+        run_parallel(pool, assign_shard, &assignment, (int)num_blocks);
+
+        /* block partials are combined in block order so the result does not depend on the thread count */
+        for (block = 0; block < num_blocks; block++) {
+            for (c = 0; c < k; c++) {
+                for (d = 0; d < dimension; d++) {
+                    new_centroids_sum[c][d] += block_sums[(block * k + c) * dimension + d];
+                }
+                cluster_weights[c] += block_weights[block * k + c];
+            }
+        }
+
+        converged = 1;
+        for (c = 0; c < k; c++) {
+            if (cluster_weights[c] > 0) {
+                for (d = 0; d < dimension; d++) {
+                    new_centroids_sum[c][d] /= cluster_weights[c];
+                }
+                
+                centroid_distance = euclidean_distance(centroids[c], new_centroids_sum[c], dimension);
+                if (centroid_distance > EPSILON) {
+                    converged = 0;
+                }
+                
+                for (d = 0; d < dimension; d++) {
+                    centroids[c][d] = new_centroids_sum[c][d];
+                }
+            } else {
+                printf("An Error Has Occurred\n");
+            }
+        }
+
+        if (converged && iter > 0) { 
+            break;
+        }
+
+        if (options->checkpoint_path && (iter + 1) % options->checkpoint_every == 0 && iter + 1 < iterations) {
+            if (!write_checkpoint(options->checkpoint_path, centroids, k, dimension, num_vectors, iter + 1, fingerprint)) {
+                printf("An Error Has Occurred\n");
+                free_centroids(centroids, k);
+                free_centroids(new_centroids_sum, k);
+                free(cluster_weights);
+                free(block_sums);
+                free(block_weights);
+                return NULL;
+            }
+        }
+    }
+
+    for (i = 0; i < k; i++) {
+        free(new_centroids_sum[i]);
+    }
+    free(new_centroids_sum);
+    free(cluster_weights);
+    free(block_sums);
+    free(block_weights);
+    return centroids;
+}
+
+/*
+ * FNV-1a over the stored bytes of the vectors (and weights, if any) that
+ * the Lloyd loop runs on, so a checkpoint is only resumed against the same
+ * input in the same storage format.
+ */
+unsigned long fingerprint_input(const dataset *data, double *weights) {
+    unsigned long hash = 2166136261UL;
+    size_t count = (size_t)data->num_vectors * data->dimension;
+
+    if (data->format == QUANTIZE_NONE) {
+        hash = hash_bytes(hash, data->values, count * sizeof(double));
+    } else if (data->format == QUANTIZE_F16) {
+        hash = hash_bytes(hash, data->halves, count * sizeof(unsigned short));
+    } else {
+        hash = hash_bytes(hash, data->codes, count * sizeof(signed char));
+        hash = hash_bytes(hash, data->scale, data->dimension * sizeof(double));
+        hash = hash_bytes(hash, data->offset, data->dimension * sizeof(double));
+    }
+
+    if (weights) {
+        hash = hash_bytes(hash, weights, data->num_vectors * sizeof(double));
+    }
+
+    return hash;
+}
+
+unsigned long hash_bytes(unsigned long hash, const void *data, size_t length) {
+    const unsigned char *bytes = data;
+    size_t i = 0;
+
+    for (i = 0; i < length; i++) {
+        hash = ((hash ^ bytes[i]) * 16777619UL) & 0xffffffffUL;
+    }
+
+    return hash;
+}
+
+/*
+ * Writes the checkpoint to "<path>.tmp", flushes it to disk and only then
+ * renames it over path, so a job killed mid-write or a node losing power
+ * leaves either the previous or the new checkpoint, never a partial one.
+ */
+int write_checkpoint(const char *path, double **centroids, int k, int dimension, int num_vectors, int next_iteration, unsigned long fingerprint) {
+    char *tmp_path;
+    FILE *file;
+    int header[4];
+    int ok = 1;
+    int c = 0;
+
+    tmp_path = malloc(strlen(path) + 5);
+    if (!tmp_path) {
+        return 0;
+    }
+    strcpy(tmp_path, path);
+    strcat(tmp_path, ".tmp");
+
+    file = fopen(tmp_path, "wb");
+    if (!file) {
+        free(tmp_path);
+        return 0;
+    }
+
+    header[0] = k;
+    header[1] = dimension;
+    header[2] = num_vectors;
+    header[3] = next_iteration;
+
+    ok = fwrite(CHECKPOINT_MAGIC, 1, sizeof(CHECKPOINT_MAGIC), file) == sizeof(CHECKPOINT_MAGIC)
+        && fwrite(header, sizeof(int), 4, file) == 4
+        && fwrite(&fingerprint, sizeof(unsigned long), 1, file) == 1;
+    for (c = 0; ok && c < k; c++) {
+        ok = fwrite(centroids[c], sizeof(double), dimension, file) == (size_t)dimension;
+    }
+
+    if (ok && fflush(file) != 0) {
+        ok = 0;
+    }
+#ifdef __linux__
+    if (ok && fsync(fileno(file)) != 0) {
+        ok = 0;
+    }
+#endif
+    if (fclose(file) != 0) {
+        ok = 0;
+    }
+    if (ok && rename(tmp_path, path) != 0) {
+        ok = 0;
+    }
+    if (!ok) {
+        remove(tmp_path);
+    }
+
+    free(tmp_path);
+    return ok;
+}
+
+int read_checkpoint(const char *path, double **centroids, int k, int dimension, int num_vectors, unsigned long fingerprint, int *next_iteration_ptr) {
+    FILE *file;
+    char magic[sizeof(CHECKPOINT_MAGIC)];
+    int header[4];
+    unsigned long saved_fingerprint = 0;
+    int ok = 1;
+    int c = 0;
+
+    file = fopen(path, "rb");
+    if (!file) {
+        return 0;
+    }
+
+    ok = fread(magic, 1, sizeof(magic), file) == sizeof(magic)
+        && memcmp(magic, CHECKPOINT_MAGIC, sizeof(magic)) == 0
+        && fread(header, sizeof(int), 4, file) == 4
+        && fread(&saved_fingerprint, sizeof(unsigned long), 1, file) == 1
+        && header[0] == k && header[1] == dimension && header[2] == num_vectors
+        && header[3] >= 0 && saved_fingerprint == fingerprint;
+    for (c = 0; ok && c < k; c++) {
+        ok = fread(centroids[c], sizeof(double), dimension, file) == (size_t)dimension;
+    }
+
+    fclose(file);
+    if (ok) {
+        *next_iteration_ptr = header[3];
+    }
+    return ok;
+}
+
+/*
+ * Builds a lightweight coreset by sensitivity sampling: each vector is drawn
+ * with probability q = 1/(2n) + d(x, mean)^2 / (2 * sum of d^2), sample_size
+ * times with replacement, and weighted by 1 / (sample_size * q) so weighted
+ * sums stay unbiased. Repeated draws of a vector are merged into one row and
+ * rows keep their input order. The sampler is seeded with CORESET_SEED so a
+ * run is reproducible.
+ * The mean, the distances and the cumulative distribution are computed on
+ * the thread pool over the same fixed row blocks as kmeans(), with each
+ * block's partial results combined in block order, so the coreset does not
+ * depend on the thread count. Only the draws themselves are sequential.
+ */
+double *build_coreset(const dataset *data, int sample_size, double **weights_ptr, int *coreset_size_ptr, thread_pool *pool) {
+    double *mean;
+    double *probabilities;
+    double *block_sums;
+    double *block_totals;
+    double *scratch;
+    int *draws;
+    double *coreset = NULL;
+    double *weights = NULL;
+    double total = 0.0;
+    double cumulative = 0.0;
+    double target = 0.0;
+    size_t num_blocks;
+    size_t block;
+    int coreset_size = 0;
+    int low = 0;
+    int high = 0;
+    int mid = 0;
+    int i = 0;
+    int d = 0;
+    int num_vectors = data->num_vectors;
+    int dimension = data->dimension;
+    coreset_task task;
+
+    num_blocks = num_row_blocks(num_vectors);
+    mean = calloc(dimension, sizeof(double));
+    probabilities = malloc(num_vectors * sizeof(double));
+    draws = calloc(num_vectors, sizeof(int));
+    block_sums = malloc(num_blocks * dimension * sizeof(double));
+    block_totals = malloc(num_blocks * sizeof(double));
+    scratch = malloc((size_t)MAX_THREADS * dimension * sizeof(double));
+    if (!mean || !probabilities || !draws || !block_sums || !block_totals || !scratch) {
+        printf("An Error Has Occurred\n");
+        free(mean);
+        free(probabilities);
+        free(draws);
+        free(block_sums);
+        free(block_totals);
+        free(scratch);
+        return NULL;
+    }
+
+    task.data = data;
+    task.centroids = NULL;
+    task.k = 0;
+    task.mean = mean;
+    task.probabilities = probabilities;
+    task.block_sums = block_sums;
+    task.block_totals = block_totals;
+    task.scratch = scratch;
+    task.total = 0.0;
+    task.num_blocks = num_blocks;
+    task.dimension = dimension;
+    select_kernels(data, &task.nearest, &task.accumulate);
+
+    run_parallel(pool, coreset_sum_shard, &task, (int)num_blocks);
+    for (block = 0; block < num_blocks; block++) {
+        for (d = 0; d < dimension; d++) {
+            mean[d] += block_sums[block * dimension + d];
+        }
+    }
+    for (d = 0; d < dimension; d++) {
+        mean[d] /= num_vectors;
+    }
+
+    run_parallel(pool, coreset_distance_shard, &task, (int)num_blocks);
+    for (block = 0; block < num_blocks; block++) {
+        total += block_totals[block];
+    }
+    task.total = total;
+
+    /* probabilities[] becomes the cumulative distribution for the draws: each
+       block sums its own rows, then is shifted by the total of the blocks before it */
+    run_parallel(pool, coreset_cumulative_shard, &task, (int)num_blocks);
+    for (block = 0; block < num_blocks; block++) {
+        total = block_totals[block];
+        block_totals[block] = cumulative;
+        cumulative += total;
+    }
+    run_parallel(pool, coreset_offset_shard, &task, (int)num_blocks);
+
+    srand(CORESET_SEED);
+    for (i = 0; i < sample_size; i++) {
+        target = random_uniform() * cumulative;
+        low = 0;
+        high = num_vectors - 1;
+        while (low < high) {
+            mid = low + (high - low) / 2;
+            if (probabilities[mid] <= target) {
+                low = mid + 1;
+            } else {
+                high = mid;
+            }
+        }
+        if (draws[low]++ == 0) {
+            coreset_size++;
+        }
+    }
+
+    coreset = malloc((size_t)coreset_size * dimension * sizeof(double));
+    weights = malloc(coreset_size * sizeof(double));
+    if (!coreset || !weights) {
+        printf("An Error Has Occurred\n");
+        free(coreset);
+        free(weights);
+        free(mean);
+        free(probabilities);
+        free(draws);
+        free(block_sums);
+        free(block_totals);
+        free(scratch);
+        return NULL;
+    }
+
+    coreset_size = 0;
+    for (i = 0; i < num_vectors; i++) {
+        if (draws[i] == 0) continue;
+
+        memcpy(coreset + (size_t)coreset_size * dimension, dataset_row(data, i, scratch), dimension * sizeof(double));
+        weights[coreset_size] = draws[i] / (sample_size * (probabilities[i] - (i > 0 ? probabilities[i - 1] : 0.0)) / cumulative);
+        coreset_size++;
+    }
+
+    free(mean);
+    free(probabilities);
+    free(draws);
+    free(block_sums);
+    free(block_totals);
+    free(scratch);
+    *weights_ptr = weights;
+    *coreset_size_ptr = coreset_size;
+    return coreset;
+}
+
+/* Sums each of this thread's row blocks into its slice of block_sums. */
+void coreset_sum_shard(void *arg, int thread_index, int num_threads) {
+    coreset_task *task = arg;
+    double *sums;
+    size_t num_rows = task->data->num_vectors;
+    size_t first_block;
+    size_t end_block;
+    size_t block;
+    size_t v;
+
+    shard_range(task->num_blocks, thread_index, num_threads, &first_block, &end_block);
+    for (block = first_block; block < end_block; block++) {
+        sums = task->block_sums + block * task->dimension;
+        memset(sums, 0, task->dimension * sizeof(double));
+        for (v = num_rows * block / task->num_blocks; v < num_rows * (block + 1) / task->num_blocks; v++) {
+            task->accumulate(sums, task->data, v, 1.0);
+        }
+    }
+}
+
+/* Stores each row's squared distance to the mean and each block's total. */
+void coreset_distance_shard(void *arg, int thread_index, int num_threads) {
+    coreset_task *task = arg;
+    double *buffer = task->scratch + (size_t)thread_index * task->dimension;
+    double total = 0.0;
+    size_t num_rows = task->data->num_vectors;
+    size_t first_block;
+    size_t end_block;
+    size_t block;
+    size_t v;
+
+    shard_range(task->num_blocks, thread_index, num_threads, &first_block, &end_block);
+    for (block = first_block; block < end_block; block++) {
+        total = 0.0;
+        for (v = num_rows * block / task->num_blocks; v < num_rows * (block + 1) / task->num_blocks; v++) {
+            task->probabilities[v] = squared_distance(dataset_row(task->data, v, buffer), task->mean, task->dimension);
+            total += task->probabilities[v];
+        }
+        task->block_totals[block] = total;
+    }
+}
+
+/* Turns distances into probabilities and runs the prefix sum within each block. */
+void coreset_cumulative_shard(void *arg, int thread_index, int num_threads) {
+    coreset_task *task = arg;
+    double cumulative = 0.0;
+    size_t num_rows = task->data->num_vectors;
+    size_t first_block;
+    size_t end_block;
+    size_t block;
+    size_t v;
+
+    shard_range(task->num_blocks, thread_index, num_threads, &first_block, &end_block);
+    for (block = first_block; block < end_block; block++) {
+        cumulative = 0.0;
+        for (v = num_rows * block / task->num_blocks; v < num_rows * (block + 1) / task->num_blocks; v++) {
+            cumulative += 0.5 / num_rows + (task->total > 0 ? 0.5 * task->probabilities[v] / task->total : 0.5 / num_rows);
+            task->probabilities[v] = cumulative;
+        }
+        task->block_totals[block] = cumulative;
+    }
+}
+
+/* Adds the total of the earlier blocks, now in block_totals, to each block's prefix sum. */
+void coreset_offset_shard(void *arg, int thread_index, int num_threads) {
+    coreset_task *task = arg;
+    size_t num_rows = task->data->num_vectors;
+    size_t first_block;
+    size_t end_block;
+    size_t block;
+    size_t v;
+
+    shard_range(task->num_blocks, thread_index, num_threads, &first_block, &end_block);
+    for (block = first_block; block < end_block; block++) {
+        if (block == 0) continue;
+
+        for (v = num_rows * block / task->num_blocks; v < num_rows * (block + 1) / task->num_blocks; v++) {
+            task->probabilities[v] += task->block_totals[block];
+        }
+    }
+}
+
+/* Uniform in [0, 1), built from two rand() calls since RAND_MAX may be small. */
+double random_uniform(void) {
+    double scale = (double)RAND_MAX + 1.0;
+    return (rand() + rand() / scale) / scale;
+}
+
+/*
+ * Stores the sum of squared distances to the nearest centroid in
+ * *inertia_ptr, summed per row block on the thread pool and combined in
+ * block order; returns -1 if memory runs out.
+ */
+int compute_inertia(const dataset *data, double **centroids, int k, double *inertia_ptr, thread_pool *pool) {
+    double inertia = 0.0;
+    double *block_totals;
+    double *scratch;
+    size_t num_blocks;
+    size_t block;
+    coreset_task task;
+
+    num_blocks = num_row_blocks(data->num_vectors);
+    block_totals = malloc(num_blocks * sizeof(double));
+    scratch = malloc((size_t)MAX_THREADS * data->dimension * sizeof(double));
+    if (!block_totals || !scratch) {
+        free(block_totals);
+        free(scratch);
+        return -1;
+    }
+
+    task.data = data;
+    task.centroids = centroids;
+    task.k = k;
+    task.mean = NULL;
+    task.probabilities = NULL;
+    task.block_sums = NULL;
+    task.block_totals = block_totals;
+    task.scratch = scratch;
+    task.total = 0.0;
+    task.num_blocks = num_blocks;
+    task.dimension = data->dimension;
+    select_kernels(data, &task.nearest, &task.accumulate);
+
+    run_parallel(pool, inertia_shard, &task, (int)num_blocks);
+    for (block = 0; block < num_blocks; block++) {
+        inertia += block_totals[block];
+    }
+
+    free(block_totals);
+    free(scratch);
+    *inertia_ptr = inertia;
+    return 0;
+}
+
+/* Sums each row block's squared distances to the nearest centroid into block_totals. */
+void inertia_shard(void *arg, int thread_index, int num_threads) {
+    coreset_task *task = arg;
+    double *buffer = task->scratch + (size_t)thread_index * task->dimension;
+    double total = 0.0;
+    size_t num_rows = task->data->num_vectors;
+    size_t first_block;
+    size_t end_block;
+    size_t block;
+    size_t v;
+    int c = 0;
+
+    shard_range(task->num_blocks, thread_index, num_threads, &first_block, &end_block);
+    for (block = first_block; block < end_block; block++) {
+        total = 0.0;
+        for (v = num_rows * block / task->num_blocks; v < num_rows * (block + 1) / task->num_blocks; v++) {
+            c = task->nearest(task->data, v, task->centroids, task->k);
+            total += squared_distance(dataset_row(task->data, v, buffer), task->centroids[c], task->dimension);
+        }
+        task->block_totals[block] = total;
+    }
+}
+
+/* Describes a contiguous block of double rows, such as a coreset, as a dataset. */
+void wrap_vectors(dataset *data, double *values, int num_vectors, int dimension) {
+    data->format = QUANTIZE_NONE;
+    data->num_vectors = num_vectors;
+    data->dimension = dimension;
+    data->values = values;
+    data->halves = NULL;
+    data->codes = NULL;
+    data->scale = NULL;
+    data->offset = NULL;
+}
+
+/*
+ * Returns one row as doubles: the stored row itself, or for quantized
+ * storage the row decoded into the caller's buffer of dimension doubles.
+ * This is for the setup and reporting paths; the Lloyd loop reads the
+ * codes through the kernels instead.
+ */
+const double *dataset_row(const dataset *data, size_t row, double *buffer) {
+    const unsigned short *halves;
+    const signed char *codes;
+    int d = 0;
+
+    if (data->format == QUANTIZE_NONE) {
+        return data->values + row * data->dimension;
+    }
+
+    if (data->format == QUANTIZE_F16) {
+        halves = data->halves + row * data->dimension;
+        for (d = 0; d < data->dimension; d++) {
+            buffer[d] = half_to_float(halves[d]);
+        }
+    } else {
+        codes = data->codes + row * data->dimension;
+        for (d = 0; d < data->dimension; d++) {
+            buffer[d] = data->offset[d] + data->scale[d] * codes[d];
+        }
+    }
+    return buffer;
+}
+
+/*
+ * Encodes one parsed row into its slot of the quantized storage and adds
+ * its coordinate errors to *squared_error and *max_error.
+ */
+void encode_row(dataset *data, size_t row, const double *values, double *squared_error, double *max_error) {
+    unsigned short *halves;
+    signed char *codes;
+    double code = 0.0;
+    double error = 0.0;
+    int d = 0;
+
+    if (data->format == QUANTIZE_F16) {
+        halves = data->halves + row * data->dimension;
+        for (d = 0; d < data->dimension; d++) {
+            halves[d] = double_to_half(values[d]);
+            error = fabs(half_to_float(halves[d]) - values[d]);
+            *squared_error += error * error;
+            if (error > *max_error) *max_error = error;
+        }
+    } else {
+        codes = data->codes + row * data->dimension;
+        for (d = 0; d < data->dimension; d++) {
+            code = data->scale[d] > 0 ? floor((values[d] - data->offset[d]) / data->scale[d] + 0.5) : 0.0;
+            if (code < -128.0) code = -128.0;
+            if (code > 127.0) code = 127.0;
+            codes[d] = (signed char)code;
+            error = fabs(data->offset[d] + data->scale[d] * codes[d] - values[d]);
+            *squared_error += error * error;
+            if (error > *max_error) *max_error = error;
+        }
+    }
+}
+
+void free_dataset(dataset *data) {
+    if (data) {
+        free(data->values);
+        free(data->halves);
+        free(data->codes);
+        free(data->scale);
+        free(data->offset);
+        free(data);
+    }
+}
+
+/* Rounds to the nearest float16; values beyond its range saturate at +-65504. */
+unsigned short double_to_half(double value) {
+    unsigned short sign = value < 0 ? 0x8000 : 0;
+    double magnitude = fabs(value);
+    double mantissa;
+    long bits;
+    int exponent = 0;
+
+    if (magnitude >= 65504.0) {
+        return sign | 0x7bff;
+    }
+
+    if (magnitude < ldexp(1.0, -14)) {
+        bits = (long)floor(magnitude * ldexp(1.0, 24) + 0.5);
+        return sign | (unsigned short)bits;
+    }
+
+    mantissa = frexp(magnitude, &exponent);
+    bits = (long)floor((2.0 * mantissa - 1.0) * 1024.0 + 0.5);
+    exponent += 14;
+    if (bits == 1024) {
+        bits = 0;
+        exponent++;
+    }
+    if (exponent >= 31) {
+        return sign | 0x7bff;
+    }
+
+    return sign | (unsigned short)(exponent << 10) | (unsigned short)bits;
+}
+
+/*
+ * Widens a float16 without branches or tables: the exponent and fraction
+ * bits are shifted into place in a float and multiplying by 2^112 rebiases
+ * the exponent, which also turns float16 subnormals into normal floats.
+ * The sign bit is copied over last. double_to_half never produces
+ * infinities or NaNs, so they need no special case.
+ */
+float half_to_float(unsigned short half) {
+    union {
+        unsigned int bits;
+        float value;
+    } widened;
+
+    widened.bits = (unsigned int)(half & 0x7fff) << 13;
+    widened.value *= 5.192296858534828e33f; /* 2^112 */
+    widened.bits |= (unsigned int)(half & 0x8000) << 16;
+    return widened.value;
 }
 
-void free_vectors_array(double **vectors, int num_vectors) {
+void free_centroids(double **centroids, int k) {
     int i = 0;
-    if (vectors) {
-        for (i = 0; i < num_vectors; i++) {
-            free(vectors[i]);
+    if (centroids) {
+        for (i = 0; i < k; i++) {
+            free(centroids[i]);
         }
-        free(vectors);
+        free(centroids);
     }
 }
 
@@ -1,16 +1,59 @@
+#include <stddef.h>
+
 #define MIN_K 1
 #define MIN_ITER 1
 #define MAX_ITER 1000
 #define DEFAULT_ITER 400
 #define INITIAL_CAPACITY 10
-#define MAX_LINE_LENGTH 1024
+#define READ_CHUNK_SIZE 65536
+#define PARSE_CHUNK_SIZE (1 << 20)
+#define STREAM_BATCH_SIZE (MAX_THREADS * PARSE_CHUNK_SIZE)
 #define EPSILON 0.001
+#define HUGEPAGE_SIZE (2 * 1024 * 1024)
+#define CORESET_SEED 1234
+#define MAX_FIXED_DIMENSION 16
+#define DEFAULT_CHECKPOINT_EVERY 10
+#define CHECKPOINT_MAGIC "KMCKPT1"
+#define QUANTIZE_NONE 0
+#define QUANTIZE_F16 1
+#define QUANTIZE_INT8 2
+#define MAX_THREADS 64
+#define MAX_NUMA_NODES 64
+#define MIN_ROWS_PER_THREAD 4096
+
+/* The structs are defined in kmeans.c; only pointers to them cross this interface. */
+typedef struct kmeans_options kmeans_options;
+typedef struct dataset dataset;
+typedef struct thread_pool thread_pool;
+
+typedef void (*parallel_task_fn)(void *arg, int thread_index, int num_threads);
+typedef int (*nearest_centroid_fn)(const dataset *data, size_t row, double **centroids, int k);
+typedef void (*accumulate_point_fn)(double *sum, const dataset *data, size_t row, double weight);
 
-int validate_input(int argc, char *argv[], int *k, int *iterations);
+int validate_input(int argc, char *argv[], int *k, int *iterations, kmeans_options *options);
+int parse_options(int argc, char *argv[], char **positional, int *num_positional, kmeans_options *options);
+int default_thread_count(void);
+int parse_positive_int(const char *s, int *value);
 int is_number(double val);
 int count_commas(const char *s);
-double **load_input(int *num_vectors_ptr, int *dimension_ptr);
-void free_vectors_array(double **vectors, int num_vectors);
+char *read_all_input(size_t *length_ptr);
+int detect_dimension(char *text);
+int parse_vector_line(const char *line, double *vec, int dim);
+size_t split_chunks(const char *buffer, size_t length, size_t **starts_ptr);
+void count_chunk_rows(void *arg, int thread_index, int num_threads);
+void parse_chunks(void *arg, int thread_index, int num_threads);
+dataset *load_input(const kmeans_options *options, thread_pool *pool);
+dataset *load_streamed_input(const kmeans_options *options, thread_pool *pool);
+int run_clustering(int k, int iterations, const kmeans_options *options, thread_pool *pool);
+void *allocate_vector_data(size_t bytes, int hugepages);
+thread_pool *create_thread_pool(int num_threads, int pin_threads);
+void destroy_thread_pool(thread_pool *pool);
+void run_parallel(thread_pool *pool, parallel_task_fn task, void *arg, int max_threads);
+void shard_range(size_t num_items, int thread_index, int num_threads, size_t *start_ptr, size_t *end_ptr);
+size_t num_row_blocks(size_t num_rows);
+void shard_rows(size_t num_rows, int thread_index, int num_threads, size_t *start_ptr, size_t *end_ptr);
+void assign_shard(void *arg, int thread_index, int num_threads);
+double squared_distance(const double *point1, const double *point2, int dimension);
 double euclidean_distance(double *point1, double *point2, int dimension);
 
 void initialize_memory(int k, double ***centroids_ptr, double ***new_centroids_sum_ptr, int **cluster_counts_ptr, int **assignments_ptr, int num_vectors, int dimension);
@@ -20,5 +63,30 @@ void assign_clusters(double **vectors, double **centroids, int *assignments, int
 void compute_new_centroids(double **vectors, double **new_centroids_sum, int *cluster_counts, int *assignments, int num_vectors, int k, int dimension);
 int update_centroids(double **centroids, double **new_centroids_sum, int *cluster_counts, int k, int dimension);
 
-void kmeans(double **vectors, int num_vectors, int dimension, int k, int iterations);
+double **cluster_points(const dataset *data, double *weights, int k, int iterations, const kmeans_options *options, double **initial_centroids, thread_pool *pool);
+double **kmeans(const dataset *data, double *weights, int k, int iterations, const kmeans_options *options, double **initial_centroids, thread_pool *pool);
+double **bisecting_kmeans(const dataset *data, double *weights, int k, int iterations);
+int split_cluster(const dataset *data, double *weights, int *members, int size, int iterations);
+void cluster_mean(const dataset *data, double *weights, const int *members, int size, double *mean);
+double cluster_sse(const dataset *data, double *weights, const int *members, int size, const double *centroid, double *buffer);
+unsigned long fingerprint_input(const dataset *data, double *weights);
+unsigned long hash_bytes(unsigned long hash, const void *data, size_t length);
+int write_checkpoint(const char *path, double **centroids, int k, int dimension, int num_vectors, int next_iteration, unsigned long fingerprint);
+int read_checkpoint(const char *path, double **centroids, int k, int dimension, int num_vectors, unsigned long fingerprint, int *next_iteration_ptr);
+double *build_coreset(const dataset *data, int sample_size, double **weights_ptr, int *coreset_size_ptr, thread_pool *pool);
+void coreset_sum_shard(void *arg, int thread_index, int num_threads);
+void coreset_distance_shard(void *arg, int thread_index, int num_threads);
+void coreset_cumulative_shard(void *arg, int thread_index, int num_threads);
+void coreset_offset_shard(void *arg, int thread_index, int num_threads);
+double random_uniform(void);
+int compute_inertia(const dataset *data, double **centroids, int k, double *inertia_ptr, thread_pool *pool);
+void inertia_shard(void *arg, int thread_index, int num_threads);
+void free_centroids(double **centroids, int k);
+void wrap_vectors(dataset *data, double *values, int num_vectors, int dimension);
+const double *dataset_row(const dataset *data, size_t row, double *buffer);
+void encode_row(dataset *data, size_t row, const double *values, double *squared_error, double *max_error);
+void free_dataset(dataset *data);
+unsigned short double_to_half(double value);
+float half_to_float(unsigned short half);
+void select_kernels(const dataset *data, nearest_centroid_fn *nearest_ptr, accumulate_point_fn *accumulate_ptr);
 void print_result(double **centroids, int k, int dimension);
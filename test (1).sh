@@ -68,6 +68,217 @@ run_test() {
     return 0
 }
 
+run_resume_test() {
+    echo "Running checkpoint/resume test (K=3, checkpoint after 3 of 5 iterations, resume to 600)..."
+
+    rm -f test_output/checkpoint
+    ./kmeans 3 5 --checkpoint test_output/checkpoint --checkpoint-every 3 < tests/input_1.txt > /dev/null
+    if [ ! -f test_output/checkpoint ]; then
+        echo ""
+        echo "FAIL: No checkpoint was written"
+        return 1
+    fi
+
+    ./kmeans 3 600 --resume test_output/checkpoint < tests/input_1.txt > test_output/c_output_resume.txt
+    diff test_output/c_output_resume.txt tests/output_1.txt > /dev/null
+    if [ $? -ne 0 ]; then
+        echo ""
+        echo "FAIL: Resumed run doesn't match expected output for test 1"
+        return 1
+    fi
+
+    echo "PASS: Checkpoint/resume test successful"
+    echo ""
+    return 0
+}
+
+run_threads_test() {
+    echo "Running multi-threaded test 6 (K=6, max_iter=300, --threads 1 vs --threads 4)..."
+
+    ./kmeans 6 300 --threads 1 < tests/input_6.txt > test_output/c_output_6_threads_1.txt
+    if [ $? -ne 0 ]; then
+        echo ""
+        echo "C implementation failed with --threads 1"
+        return 1
+    fi
+
+    ./kmeans 6 300 --threads 4 < tests/input_6.txt > test_output/c_output_6_threads_4.txt
+    if [ $? -ne 0 ]; then
+        echo ""
+        echo "C implementation failed with --threads 4"
+        return 1
+    fi
+
+    diff test_output/c_output_6_threads_1.txt test_output/c_output_6_threads_4.txt > /dev/null
+    if [ $? -ne 0 ]; then
+        echo ""
+        echo "FAIL: --threads 1 and --threads 4 outputs differ for test 6"
+        return 1
+    fi
+
+    diff test_output/c_output_6_threads_4.txt tests/output_6.txt > /dev/null
+    if [ $? -ne 0 ]; then
+        echo ""
+        echo "FAIL: Output doesn't match expected output for test 6"
+        return 1
+    fi
+
+    echo "PASS: Multi-threaded test 6 successful"
+    echo ""
+    return 0
+}
+
+run_quantize_test() {
+    for format in int8 f16; do
+        echo "Running $format quantization test (K=3, max_iter=600)..."
+
+        ./kmeans 3 600 --quantize $format < tests/input_1.txt > test_output/c_output_$format.txt 2> test_output/c_error_$format.txt
+        if [ $? -ne 0 ]; then
+            echo ""
+            echo "C implementation failed with --quantize $format"
+            return 1
+        fi
+
+        diff test_output/c_output_$format.txt tests/output_1_$format.txt > /dev/null
+        if [ $? -ne 0 ]; then
+            echo ""
+            echo "FAIL: Quantized centroids don't match expected output for test 1 ($format)"
+            return 1
+        fi
+
+        diff test_output/c_error_$format.txt tests/output_1_${format}_error.txt > /dev/null
+        if [ $? -ne 0 ]; then
+            echo ""
+            echo "FAIL: Quantization error report doesn't match expected output for test 1 ($format)"
+            return 1
+        fi
+
+        echo "PASS: $format quantization test successful"
+        echo ""
+    done
+    return 0
+}
+
+run_coreset_test() {
+    echo "Running coreset test (K=3, max_iter=600, --coreset 200)..."
+
+    ./kmeans 3 600 --coreset 200 < tests/input_1.txt > test_output/c_output_coreset.txt 2> test_output/c_error_coreset.txt
+    if [ $? -ne 0 ]; then
+        echo ""
+        echo "C implementation failed with --coreset 200"
+        return 1
+    fi
+
+    diff test_output/c_output_coreset.txt tests/output_1_coreset.txt > /dev/null
+    if [ $? -ne 0 ]; then
+        echo ""
+        echo "FAIL: Coreset centroids don't match expected output for test 1"
+        return 1
+    fi
+
+    diff test_output/c_error_coreset.txt tests/output_1_coreset_error.txt > /dev/null
+    if [ $? -ne 0 ]; then
+        echo ""
+        echo "FAIL: Coreset inertia doesn't match expected output for test 1"
+        return 1
+    fi
+
+    echo "Running coreset fallback test (K=3, max_iter=600, --coreset 1000 >= 799 rows)..."
+
+    ./kmeans 3 600 --coreset 1000 < tests/input_1.txt > test_output/c_output_coreset_fallback.txt 2> test_output/c_error_coreset_fallback.txt
+    if [ $? -ne 0 ]; then
+        echo ""
+        echo "C implementation failed with --coreset 1000"
+        return 1
+    fi
+
+    diff test_output/c_output_coreset_fallback.txt tests/output_1.txt > /dev/null
+    if [ $? -ne 0 ]; then
+        echo ""
+        echo "FAIL: Coreset fallback doesn't match the full-data output for test 1"
+        return 1
+    fi
+
+    diff test_output/c_error_coreset_fallback.txt tests/output_1_coreset_fallback_error.txt > /dev/null
+    if [ $? -ne 0 ]; then
+        echo ""
+        echo "FAIL: Coreset fallback inertia doesn't match expected output for test 1"
+        return 1
+    fi
+
+    echo "PASS: Coreset test successful"
+    echo ""
+    return 0
+}
+
+run_bisecting_test() {
+    echo "Running bisecting test 3 (K=15, max_iter=300, --bisecting)..."
+
+    ./kmeans 15 300 --bisecting < tests/input_3.txt > test_output/c_output_3_bisecting.txt
+    if [ $? -ne 0 ]; then
+        echo ""
+        echo "C implementation failed with --bisecting"
+        return 1
+    fi
+
+    diff test_output/c_output_3_bisecting.txt tests/output_3_bisecting.txt > /dev/null
+    if [ $? -ne 0 ]; then
+        echo ""
+        echo "FAIL: Bisecting centroids don't match expected output for test 3"
+        return 1
+    fi
+
+    echo "Running bisecting test 3 (K=15, max_iter=300, --bisecting --refine)..."
+
+    ./kmeans 15 300 --bisecting --refine < tests/input_3.txt > test_output/c_output_3_bisecting_refine.txt
+    if [ $? -ne 0 ]; then
+        echo ""
+        echo "C implementation failed with --bisecting --refine"
+        return 1
+    fi
+
+    diff test_output/c_output_3_bisecting_refine.txt tests/output_3_bisecting_refine.txt > /dev/null
+    if [ $? -ne 0 ]; then
+        echo ""
+        echo "FAIL: Refined bisecting centroids don't match expected output for test 3"
+        return 1
+    fi
+
+    echo "Running bisecting option checks (--refine alone, --bisecting --checkpoint without --refine)..."
+
+    ./kmeans 3 600 --refine < tests/input_1.txt > test_output/c_output_refine_only.txt
+    if [ $? -eq 0 ]; then
+        echo ""
+        echo "FAIL: --refine without --bisecting was accepted"
+        return 1
+    fi
+
+    diff test_output/c_output_refine_only.txt tests/output_general_error.txt > /dev/null
+    if [ $? -ne 0 ]; then
+        echo ""
+        echo "FAIL: --refine without --bisecting doesn't print the expected error"
+        return 1
+    fi
+
+    ./kmeans 3 600 --bisecting --checkpoint test_output/bisecting.ckpt < tests/input_1.txt > test_output/c_output_bisecting_checkpoint.txt
+    if [ $? -eq 0 ] || [ -e test_output/bisecting.ckpt ]; then
+        echo ""
+        echo "FAIL: --bisecting --checkpoint without --refine was accepted"
+        return 1
+    fi
+
+    diff test_output/c_output_bisecting_checkpoint.txt tests/output_general_error.txt > /dev/null
+    if [ $? -ne 0 ]; then
+        echo ""
+        echo "FAIL: --bisecting --checkpoint without --refine doesn't print the expected error"
+        return 1
+    fi
+
+    echo "PASS: Bisecting test successful"
+    echo ""
+    return 0
+}
+
 run_test 1 3 600
 test1_result=$?
 
@@ -77,8 +288,23 @@ test2_result=$?
 run_test 3 15 300
 test3_result=$?
 
+run_resume_test
+resume_result=$?
+
+run_threads_test
+threads_result=$?
+
+run_quantize_test
+quantize_result=$?
+
+run_coreset_test
+coreset_result=$?
+
+run_bisecting_test
+bisecting_result=$?
+
 
-if [ $test1_result -eq 0 ] && [ $test2_result -eq 0 ] && [ $test3_result -eq 0 ]; then
+if [ $test1_result -eq 0 ] && [ $test2_result -eq 0 ] && [ $test3_result -eq 0 ] && [ $resume_result -eq 0 ] && [ $quantize_result -eq 0 ] && [ $threads_result -eq 0 ] && [ $coreset_result -eq 0 ] && [ $bisecting_result -eq 0 ]; then
     rm -rf test_output
     rm -f kmeans
     echo "All tests passed!"